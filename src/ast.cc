@@ -32,8 +32,9 @@ struct entry {
     Memory_Type type;
 };
 
-static int pool_size, next_pool_slot;
-static struct entry *pool;
+/* per-thread, so that programs may be compiled in parallel */
+static thread_local int pool_size, next_pool_slot;
+static thread_local struct entry *pool;
 
 void
 begin_code_allocation()
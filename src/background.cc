@@ -232,6 +232,8 @@ background_thread(void (*callback)(Var, Var*, void*), Var* data, void *extra_dat
         w->cleanup = cleanup;
         w->data = *data;
         w->extra_data = extra_data;
+        /* the thread may take references to parts of it */
+        share_var(w->data);
         if (pipe(w->fd) == -1)
         {
             log_perror("Failed to create pipe for background thread");
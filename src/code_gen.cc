@@ -15,6 +15,7 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include <ctype.h>
 #include <limits.h>
 
 #include "ast.h"
@@ -241,6 +242,48 @@ add_fixup(enum fixup_kind kind, unsigned value, State * state)
     return add_linked_fixup(kind, value, -1, state);
 }
 
+/* Literals that could name a property or verb are shared with the
+ * names of the properties themselves, so they usually match by pointer.
+ */
+static int
+looks_like_name(const char *s)
+{
+    if (!isalpha((unsigned char) *s) && *s != '_')
+        return 0;
+    while (*++s)
+        if (!isalnum((unsigned char) *s) && *s != '_')
+            return 0;
+    return 1;
+}
+
+/* Off on the threads compiling verbs while the database is loaded (see
+ * `compile_programs_in_parallel()' in db_file.cc), which share nothing
+ * with the main thread until they are done.
+ */
+static thread_local int literal_interning = 1;
+
+void
+set_literal_interning(int on)
+{
+    literal_interning = on;
+}
+
+void
+intern_program_literals(Program *prog)
+{
+    unsigned i;
+
+    for (i = 0; i < prog->num_literals; i++) {
+        Var *v = &prog->literals[i];
+
+        if (v->type == TYPE_STR) {
+            v->v.str = str_intern_owned(v->v.str);
+            if (looks_like_name(v->v.str))
+                v->v.str = str_intern_name(v->v.str);
+        }
+    }
+}
+
 static void
 add_literal(Var v, State * state)
 {
@@ -275,7 +318,12 @@ add_literal(Var v, State * state)
             Var nv;
 
             nv.type = TYPE_STR;
-            nv.v.str = str_intern(v.v.str);
+            if (literal_interning) {
+                nv.v.str = str_intern(v.v.str);
+                if (looks_like_name(nv.v.str))
+                    nv.v.str = str_intern_name(nv.v.str);
+            } else
+                nv.v.str = str_dup(v.v.str);
             gstate->literals[i = gstate->num_literals++] = nv;
         } else {
             gstate->literals[i = gstate->num_literals++] = var_ref(v);
@@ -20,10 +20,22 @@
  *****************************************************************************/
 
 #include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-
+#include <glob.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "code_gen.h"
 #include "collection.h"
 #include "config.h"
 #include "db.h"
@@ -36,17 +48,21 @@
 #include "storage.h"
 #include "streams.h"
 #include "str_intern.h"
+#include "sym_table.h"
 #include "tasks.h"
 #include "timers.h"
 #include "utils.h"
 #include "version.h"
 #include "waif.h"
 #include "map.h"
+#include "thpool.h"
 
 static char *input_db_name, *dump_db_name;
 static int dump_generation = 0;
 static const char *header_format_string
     = "** LambdaMOO Database, Format Version %u **\n";
+static const char *delta_header_format_string
+    = "** LambdaMOO Database Delta, Format Version %u **\n";
 
 DB_Version dbio_input_version;
 
@@ -161,6 +177,7 @@ dbv4_count_properties(Objid oid)
  * db_all_users
  * dbpriv_dbio_failed
  * dbpriv_set_dbio_output
+ * dbpriv_flush_dbio_output
  * dbpriv_set_dbio_input
  */
 
@@ -175,6 +192,9 @@ read_verbdef(Verbdef * v)
     v->prep = dbio_read_num();
     v->next = nullptr;
     v->program = nullptr;
+    v->source = nullptr;
+    v->unparsable = false;
+    v->edited = false;
 }
 
 static void
@@ -291,39 +311,17 @@ v4_read_object(void)
     return 1;
 }
 
-static int
-ng_read_object(int anonymous)
+/* Reads everything saved with an object after its header line, but
+ * leaves the warnings to check_propdef_names(), so that it can be done
+ * on other threads.
+ */
+static void
+ng_decode_object_fields(Object *o)
 {
-    Objid oid;
-    Object *o;
-    char s[20];
     int i;
     Verbdef *v, **prevv;
     int nprops;
 
-    if (dbio_scanf("#%" SCNdN, &oid) != 1)
-        return 0;
-    dbio_read_line(s, sizeof(s));
-
-    if (strcmp(s, " recycled\n") == 0) {
-        dbpriv_new_recycled_object();
-        return 1;
-    } else if (strcmp(s, "\n") != 0)
-        return 0;
-
-    /* At the point at which we're reading anonymous objects, we know
-     * we've already created all of the anonymous objects (they were
-     * created from references in tasks, other objects or the list
-     * of values pending finalization).
-     */
-    if (anonymous) {
-        o = dbpriv_find_object(oid);
-    }
-    else {
-        o = dbpriv_new_object(-1);
-        dbpriv_assign_nonce(o);
-    }
-
     o->name = dbio_read_string_intern();
     o->flags = dbio_read_num();
 
@@ -362,13 +360,8 @@ ng_read_object(int anonymous)
         o->propdefs.l = (Propdef *)mymalloc(i * sizeof(Propdef), M_PROPDEF);
         o->propdefs.cur_length = i;
         o->propdefs.max_length = i;
-        for (i = 0; i < o->propdefs.cur_length; i++) {
+        for (i = 0; i < o->propdefs.cur_length; i++)
             o->propdefs.l[i] = read_propdef();
-#define CHECK_PROP_NAME(PROPERTY, property) !strcasecmp(o->propdefs.l[i].name, #property) ||
-            if (BUILTIN_PROPERTIES(CHECK_PROP_NAME) 0)
-                oklog("DB_WARNING: Property #%" PRIdN ".%s has a reserved name\n", o->id, o->propdefs.l[i].name);
-#undef CHECK_PROP
-        }
     }
 
     o->nval = nprops = dbio_read_num();
@@ -380,23 +373,116 @@ ng_read_object(int anonymous)
     for (i = 0; i < nprops; i++) {
         read_propval(o->propval + i);
     }
+}
 
-    return 1;
+static void
+check_propdef_names(Object *o)
+{
+    int i;
+
+    for (i = 0; i < o->propdefs.cur_length; i++) {
+#define CHECK_PROP_NAME(PROPERTY, property) !strcasecmp(o->propdefs.l[i].name, #property) ||
+        if (BUILTIN_PROPERTIES(CHECK_PROP_NAME) 0)
+            oklog("DB_WARNING: Property #%" PRIdN ".%s has a reserved name\n", o->id, o->propdefs.l[i].name);
+#undef CHECK_PROP
+    }
 }
 
+/* Reads everything saved with an object after its header line. */
 static void
-ng_write_object(Objid oid)
+ng_read_object_fields(Object *o)
+{
+    ng_decode_object_fields(o);
+    check_propdef_names(o);
+}
+
+/* Reads past everything ng_read_object_fields() would read, returning
+ * false if the object holds anything that has to be read in order (see
+ * dbpriv_skip_dbio_var()).
+ */
+static int
+ng_skip_object_fields(void)
+{
+    int ok = 1;
+    Num i;
+
+    dbpriv_skip_dbio_string();  /* name */
+    (void) dbio_read_num();     /* flags */
+    (void) dbio_read_objid();   /* owner */
+
+    ok &= dbpriv_skip_dbio_var();       /* location */
+    if (dbio_input_version >= DBV_Last_Move)
+        ok &= dbpriv_skip_dbio_var();   /* last_move */
+    ok &= dbpriv_skip_dbio_var();       /* contents */
+    ok &= dbpriv_skip_dbio_var();       /* parents */
+    ok &= dbpriv_skip_dbio_var();       /* children */
+
+    for (i = dbio_read_num(); i > 0; i--) {
+        dbpriv_skip_dbio_string();
+        (void) dbio_read_objid();
+        (void) dbio_read_num();
+        (void) dbio_read_num();
+    }
+
+    for (i = dbio_read_num(); i > 0; i--)
+        dbpriv_skip_dbio_string();
+
+    for (i = dbio_read_num(); i > 0; i--) {
+        ok &= dbpriv_skip_dbio_var();
+        (void) dbio_read_objid();
+        (void) dbio_read_num();
+    }
+
+    return ok;
+}
+
+static int
+ng_read_object(int anonymous)
 {
+    Objid oid;
     Object *o;
+    char s[20];
+
+    if (dbio_scanf("#%" SCNdN, &oid) != 1)
+        return 0;
+    dbio_read_line(s, sizeof(s));
+
+    if (strcmp(s, " recycled\n") == 0) {
+        dbpriv_new_recycled_object();
+        return 1;
+    } else if (strcmp(s, "\n") != 0)
+        return 0;
+
+    /* At the point at which we're reading anonymous objects, we know
+     * we've already created all of the anonymous objects (they were
+     * created from references in tasks, other objects or the list
+     * of values pending finalization).
+     */
+    if (anonymous) {
+        o = dbpriv_find_object(oid);
+    }
+    else {
+        o = dbpriv_new_object(-1);
+        dbpriv_assign_nonce(o);
+    }
+
+    ng_read_object_fields(o);
+
+    return 1;
+}
+
+/* Writes object `oid', which is `o', or recycled if that's null. */
+static void
+ng_write_object_record(Objid oid, Object *o)
+{
     Verbdef *v;
     int i;
     int nverbdefs, nprops;
 
-    if (!valid(oid)) {
+    if (!o) {
         dbio_printf("#% " PRIdN " recycled\n", oid);
         return;
     }
-    o = dbpriv_find_object(oid);
 
     dbio_printf("#%" PRIdN "\n", oid);
     dbio_write_string(o->name);
@@ -406,10 +492,10 @@ ng_write_object(Objid oid)
 
     dbio_write_var(o->location);
     dbio_write_var(o->last_move);
-    dbio_write_var(o->contents);
+    dbio_write_var(dbpriv_object_contents(o));
 
     dbio_write_var(o->parents);
-    dbio_write_var(o->children);
+    dbio_write_var(dbpriv_object_children(o));
 
     for (v = o->verbdefs, nverbdefs = 0; v; v = v->next)
         nverbdefs++;
@@ -427,6 +513,12 @@ ng_write_object(Objid oid)
     for (i = 0; i < nprops; i++)
         write_propval(o->propval + i);
 }
+
+static void
+ng_write_object(Objid oid)
+{
+    ng_write_object_record(oid, valid(oid) ? dbpriv_find_object(oid) : nullptr);
+}
 
 
 /*********** File-level Input ***********/
@@ -824,15 +916,435 @@ fmt_verb_name(void *data)
     return reset_stream(s);
 }
 
+/*********** Parallel verb compilation ***********/
+
+/* Verb programs that must be compiled at load time have their text
+ * read first, and are then compiled by a pool of threads.  The parser
+ * and code generator keep their state per-thread.  The threads copy
+ * string literals rather than interning them, since the intern table
+ * isn't locked; the main thread interns them once the threads are done.
+ */
+
+typedef struct pending_program {
+    Objid oid;
+    Num vnum;
+    const char *name;		/* for error messages */
+    const char *text;
+    Program *program;
+} pending_program;
+
+typedef struct compile_job {
+    pending_program *pending;
+    Num count;
+    DB_Version version;
+    std::atomic<Num> next;
+} compile_job;
+
 static int
-read_db_file(void)
+thread_count(int n)
+{
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+static void
+compile_pending_programs(void *data)
+{
+    compile_job *job = (compile_job *)data;
+    Num i;
+
+    set_literal_interning(0);
+    while ((i = job->next++) < job->count) {
+        pending_program *pp = job->pending + i;
+        pp->program = dbio_parse_program_text(job->version, pp->text,
+                                              nullptr, (void *)pp->name);
+    }
+    set_literal_interning(1);
+}
+
+static void
+compile_programs_in_parallel(pending_program *pending, Num count,
+                             DB_Version version, int nthreads)
+{
+    compile_job job;
+    threadpool pool;
+    int i;
+
+    job.pending = pending;
+    job.count = count;
+    job.version = version;
+    job.next = 0;
+
+    /* build the shared table of built-in variable names up front,
+     * rather than letting the workers race for it
+     */
+    free_names(new_builtin_names(version));
+
+    pool = thpool_init(nthreads);
+    for (i = 0; i < nthreads; i++)
+        thpool_add_work(pool, compile_pending_programs, &job);
+    thpool_wait(pool);
+    thpool_destroy(pool);
+}
+
+static int
+read_verb_programs(Num nprogs)
 {
     Objid oid;
-    Var user_list;
-    Num i, nobjs, nprogs, nusers, vnum, dummy;
+    Num i, vnum;
     db_verb_handle h;
     Program *program;
 
+    /* compiled programs are only usable if they came from our compiler */
+    bool bytecode_ok = false;
+    if (DBV_Bytecode <= dbio_input_version) {
+        unsigned fingerprint;
+
+        if (dbio_scanf("%u\n", &fingerprint) != 1) {
+            errlog("READ_DB_FILE: Bad compiler fingerprint\n");
+            return 0;
+        }
+        bytecode_ok = fingerprint == dbio_bytecode_fingerprint();
+        if (!bytecode_ok)
+            oklog("LOADING: Compiled verb programs are from a different server; recompiling ...\n");
+    }
+
+#ifdef LAZY_VERB_COMPILATION
+    /* compiled by `db_verb_program()' on first use */
+    bool lazy = current_db_version == dbio_input_version;
+#else
+    bool lazy = false;
+#endif
+    int nthreads = thread_count(VERB_COMPILATION_THREADS);
+    pending_program *pending = nullptr;
+    Num npending = 0;
+
+    if (!lazy && nthreads > 1 && nprogs > 1)
+        pending = (pending_program *)mymalloc(nprogs * sizeof(pending_program), M_STRUCT);
+
+    oklog("LOADING: Reading %" PRIdN " MOO verb program%s ...\n", nprogs, nprogs > 1 ? "s" : "");
+    for (i = 1; i <= nprogs; i++) {
+        Num compiled = 0;
+
+        if (DBV_Bytecode <= dbio_input_version) {
+            if (dbio_scanf("#%" SCNdN ":%" SCNdN " %" SCNdN "\n", &oid, &vnum, &compiled) != 3) {
+                errlog("READ_DB_FILE: Bad program header, i = %" PRIdN ".\n", i);
+                return 0;
+            }
+        } else if (dbio_scanf("#%" SCNdN ":%" SCNdN "\n", &oid, &vnum) != 2) {
+            errlog("READ_DB_FILE: Bad program header, i = %" PRIdN ".\n", i);
+            return 0;
+        }
+        if (!valid(oid)) {
+            errlog("READ_DB_FILE: Verb for non-existant object: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+            return 0;
+        }
+        h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);  /* DB file is 0-based. */
+        if (!h.ptr) {
+            errlog("READ_DB_FILE: Unknown verb index: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+            return 0;
+        }
+        const char *text = nullptr;
+
+        program = nullptr;
+        if (compiled && bytecode_ok) {
+            /* keep the source until the compiled form has been checked */
+            text = dbio_read_program_text();
+            if (!text) {
+                errlog("READ_DB_FILE: Unexpected EOF in program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+                return 0;
+            }
+            program = dbio_read_program_bytecode();
+            compiled = 0;
+            if (program) {
+                db_set_verb_program(h, program);
+                free_str(text);
+                text = nullptr;
+            } else
+                errlog("READ_DB_FILE: Bad compiled program #%" PRIdN ":%" PRIdN "; compiling its source instead.\n", oid, vnum);
+        }
+        if (program)
+            ;
+        else if (lazy || pending || text) {
+            if (!text)
+                text = dbio_read_program_text();
+            if (!text) {
+                errlog("READ_DB_FILE: Unexpected EOF in program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+                return 0;
+            }
+            if (lazy)
+                dbpriv_set_verb_source(h, text);
+            else if (pending) {
+                pending[npending].oid = oid;
+                pending[npending].vnum = vnum;
+                pending[npending].name = str_dup(fmt_verb_name(&h));
+                pending[npending].text = text;
+                pending[npending].program = nullptr;
+                npending++;
+            } else {
+                program = dbio_parse_program_text(dbio_input_version, text, fmt_verb_name, &h);
+                free_str(text);
+                if (!program) {
+                    errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+                    return 0;
+                }
+                db_set_verb_program(h, program);
+            }
+        } else {
+            program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
+            if (!program) {
+                errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+                return 0;
+            }
+            db_set_verb_program(h, program);
+        }
+        if (compiled) {
+            /* not usable here; the source has been taken care of */
+            program = dbio_read_program_bytecode();
+            if (program)
+                free_program(program);
+        }
+        if (i % 5000 == 0 || i == nprogs)
+            oklog("LOADING: Done reading %" PRIdN " verb program%s ...\n", i, i > 1 ? "s" : "");
+    }
+
+    if (pending) {
+        int ok = 1;
+
+        oklog("LOADING: Compiling %" PRIdN " verb programs with %d threads ...\n", npending, nthreads);
+        compile_programs_in_parallel(pending, npending, dbio_input_version, nthreads);
+
+        /* attach them in the order they were read */
+        for (i = 0; i < npending; i++) {
+            pending_program *pp = pending + i;
+
+            if (ok && !pp->program) {
+                errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", pp->oid, pp->vnum);
+                ok = 0;
+            }
+            if (ok) {
+                intern_program_literals(pp->program);
+                h = db_find_indexed_verb(Var::new_obj(pp->oid), pp->vnum + 1);
+                db_set_verb_program(h, pp->program);
+            } else if (pp->program)
+                free_program(pp->program);
+            free_str(pp->name);
+            free_str(pp->text);
+        }
+        myfree(pending, M_STRUCT);
+
+        if (!ok)
+            return 0;
+        oklog("LOADING: Done compiling %" PRIdN " verb programs ...\n", npending);
+    }
+
+    return 1;
+}
+
+/* Permanent objects are read by several threads at once (see
+ * DB_LOAD_THREADS in options.h).  A first pass through the object
+ * section notes where each object's fields start and end, without
+ * building anything.  The objects are then created in order and their
+ * fields read by the threads, except for those holding anonymous
+ * objects or WAIFs, which the main thread reads in order afterwards.
+ * The threads copy strings rather than interning them; the main thread
+ * interns them once the threads are done.
+ */
+
+typedef struct object_extent {
+    Object *o;                  /* null if recycled */
+    long start, end;            /* input marks */
+    bool in_order;              /* read by the main thread */
+    bool ok;
+} object_extent;
+
+typedef struct object_job {
+    object_extent *extents;
+    Num count;
+    std::atomic<Num> next;
+} object_job;
+
+static void
+read_object_extents(void *data)
+{
+    object_job *job = (object_job *)data;
+    Num i;
+
+    dbpriv_set_dbio_interning(0);
+    while ((i = job->next++) < job->count) {
+        object_extent *x = job->extents + i;
+
+        if (x->o && !x->in_order) {
+            dbpriv_set_dbio_input_range(x->start, x->end);
+            ng_decode_object_fields(x->o);
+            x->ok = dbpriv_dbio_input_mark() == x->end;
+        }
+    }
+    dbpriv_set_dbio_interning(1);
+    dbpriv_release_dbio_buffers();
+}
+
+static void
+intern_value(Var *v)
+{
+    Num i;
+
+    switch (v->type) {
+        case TYPE_STR:
+            v->v.str = str_intern_owned(v->v.str);
+            break;
+        case TYPE_LIST:
+            for (i = 1; i <= v->v.list[0].v.num; i++)
+                intern_value(&v->v.list[i]);
+            break;
+        case TYPE_MAP: {
+            rbtrav trav;
+            rbnode *node;
+
+            for (node = rbtfirst(&trav, v->v.tree); node; node = rbtnext(&trav)) {
+                intern_value(&node->key);
+                intern_value(&node->value);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void
+intern_object_strings(Object *o)
+{
+    Verbdef *v;
+    unsigned i;
+
+    o->name = str_intern_owned(o->name);
+    intern_value(&o->location);
+    intern_value(&o->last_move);
+    intern_value(&o->contents);
+    intern_value(&o->parents);
+    intern_value(&o->children);
+    for (v = o->verbdefs; v; v = v->next)
+        v->name = str_intern_owned(v->name);
+    for (i = 0; i < (unsigned) o->propdefs.cur_length; i++)
+        o->propdefs.l[i].name = str_intern_name(str_intern_owned(o->propdefs.l[i].name));
+    for (i = 0; i < o->nval; i++)
+        intern_value(&o->propval[i].var);
+}
+
+/* Returns 1 if the objects were read, 0 if they are bad, or -1 if they
+ * have to be read one at a time instead.
+ */
+static int
+ng_read_objects_in_parallel(Num nobjs)
+{
+    int nthreads = thread_count(DB_LOAD_THREADS);
+    long section = dbpriv_dbio_input_mark(), after = -1;
+    object_extent *extents;
+    object_job job;
+    threadpool pool;
+    Num i, nthreaded = 0;
+    int ok = 1;
+
+    if (nthreads <= 1 || nobjs <= 1 || section < 0)
+        return -1;
+
+    extents = (object_extent *)mymalloc(nobjs * sizeof(object_extent), M_STRUCT);
+    for (i = 0; i < nobjs; i++) {
+        object_extent *x = extents + i;
+        Objid oid;
+        char s[20];
+
+        if (dbio_scanf("#%" SCNdN, &oid) != 1)
+            break;
+        dbio_read_line(s, sizeof(s));
+
+        x->o = nullptr;
+        x->start = x->end = -1;
+        if (strcmp(s, " recycled\n") == 0)
+            continue;
+        if (strcmp(s, "\n") != 0 || (x->start = dbpriv_dbio_input_mark()) < 0)
+            break;
+        x->in_order = !ng_skip_object_fields();
+        if ((x->end = dbpriv_dbio_input_mark()) < 0)
+            break;
+    }
+    if (i == nobjs)
+        after = dbpriv_dbio_input_mark();
+    if (after < 0) {
+        /* leave it, and any complaints, to ng_read_object() */
+        myfree(extents, M_STRUCT);
+        dbpriv_set_dbio_input_range(section, -1);
+        return -1;
+    }
+
+    for (i = 0; i < nobjs; i++) {
+        object_extent *x = extents + i;
+
+        if (x->start < 0) {
+            dbpriv_new_recycled_object();
+            continue;
+        }
+        x->o = dbpriv_new_object(-1);
+        dbpriv_assign_nonce(x->o);
+        x->ok = true;
+        if (!x->in_order)
+            nthreaded++;
+    }
+
+    /* build the shared empty values up front, rather than letting the
+     * threads race for them
+     */
+    free_var(new_list(0));
+    free_var(new_map());
+    free_str(str_dup(""));
+
+    oklog("LOADING: Reading %" PRIdN " objects with %d threads ...\n", nthreaded, nthreads);
+    job.extents = extents;
+    job.count = nobjs;
+    job.next = 0;
+    pool = thpool_init(nthreads);
+    for (i = 0; i < nthreads; i++)
+        thpool_add_work(pool, read_object_extents, &job);
+    thpool_wait(pool);
+    thpool_destroy(pool);
+
+    for (i = 0; i < nobjs; i++) {
+        object_extent *x = extents + i;
+
+        if (x->o) {
+            if (x->in_order) {
+                dbpriv_set_dbio_input_range(x->start, -1);
+                ng_decode_object_fields(x->o);
+                x->ok = dbpriv_dbio_input_mark() == x->end;
+            } else
+                intern_object_strings(x->o);
+            if (!x->ok) {
+                errlog("READ_DB_FILE: Bad object #%" PRIdN ".\n", i);
+                ok = 0;
+                break;
+            }
+            check_propdef_names(x->o);
+        }
+        if ((i + 1) % 10000 == 0 || i + 1 == nobjs)
+            oklog("LOADING: Done reading %" PRIdN " object%s ...\n", i + 1, i > 0 ? "s" : "");
+    }
+
+    myfree(extents, M_STRUCT);
+    dbpriv_set_dbio_input_range(after, -1);
+
+    return ok;
+}
+
+static int
+read_db_file(void)
+{
+    Var user_list;
+    Num i, nobjs, nprogs, nusers, dummy;
+    int parallel = -1;
+
     waif_before_loading();
 
     if (dbio_scanf(header_format_string, &dbio_input_version) != 1)
@@ -904,7 +1416,11 @@ read_db_file(void)
     }
 
     oklog("LOADING: Reading %" PRIdN " object%s ...\n", nobjs, nobjs > 1 ? "s" : "");
-    for (i = 1; i <= nobjs; i++) {
+    if (DBV_NextGen <= dbio_input_version)
+        parallel = ng_read_objects_in_parallel(nobjs);
+    if (parallel == 0)
+        return 0;
+    for (i = 1; parallel < 0 && i <= nobjs; i++) {
         if (DBV_NextGen > dbio_input_version) {
             if (!v4_read_object()) {
                 errlog("READ_DB_FILE: Bad object #%" PRIdN ".\n", i - 1);
@@ -968,69 +1484,1609 @@ read_db_file(void)
         }
     }
 
-    oklog("LOADING: Reading %" PRIdN " MOO verb program%s ...\n", nprogs, nprogs > 1 ? "s" : "");
-    for (i = 1; i <= nprogs; i++) {
-        if (dbio_scanf("#%" SCNdN ":%" SCNdN "\n", &oid, &vnum) != 2) {
-            errlog("READ_DB_FILE: Bad program header, i = %" PRIdN ".\n", i);
+    if (!read_verb_programs(nprogs))
+        return 0;
+
+    if (DBV_Anon > dbio_input_version) {
+        oklog("LOADING: Reading forked and suspended tasks ...\n");
+        if (!read_task_queue()) {
+            errlog("READ_DB_FILE: Can't read task queue.\n");
+            return 0;
+        }
+
+        oklog("LOADING: Reading list of formerly active connections ...\n");
+        if (!read_active_connections()) {
+            errlog("DB_READ: Can't read active connections.\n");
+            return 0;
+        }
+    }
+
+    /* see db_objects.c */
+    dbpriv_after_load();
+    waif_after_loading();
+
+    return 1;
+}
+
+/*********** Checkpoint deltas ***********/
+
+/* A checkpoint delta (`<database>.delta') brings the full dump it sits
+ * next to up to date.  It holds the users, the values pending
+ * finalization, the task queue and the active connections in full,
+ * which supersede those in the full dump, followed by every object
+ * that changed since some snapshot no later than the full dump's (and
+ * every recycled object number), and the programs of those objects'
+ * verbs.  It also records the size and modification time of the full
+ * dump it was written against, and is only applied on top of that
+ * file.  It is written next to the output database, which may then be
+ * moved into place as the input (as restart.sh does) without it, so it
+ * is looked for next to both.
+ *
+ * Anonymous objects and WAIFs are only identified within a single file,
+ * so a delta can't refer to any; a checkpoint that would need to is
+ * written in full instead.
+ */
+
+static char *
+delta_db_name(const char *db_name)
+{
+    Stream *s = new_stream(100);
+    char *name;
+
+    stream_printf(s, "%s.delta", db_name);
+    name = str_dup(stream_contents(s));
+    free_stream(s);
+
+    return name;
+}
+
+/* Returns 1 if the delta was applied to the full dump `base' and 0 on
+ * failure, including when it was written against some other dump (or
+ * a copy of `base' that didn't keep its modification time).
+ */
+static int
+read_delta_file(struct stat *base)
+{
+    Var user_list;
+    Num i, nobjs, nprogs, nusers, base_size, base_mtime;
+    Objid oid, last_oid;
+    char s[20];
+
+    if (dbio_scanf(delta_header_format_string, &dbio_input_version) != 1
+            || dbio_input_version != current_db_version) {
+        errlog("READ_DELTA_FILE: Unknown delta format\n");
+        return 0;
+    }
+    if (dbio_scanf("%" SCNdN " %" SCNdN "\n", &base_size, &base_mtime) != 2) {
+        errlog("READ_DELTA_FILE: Bad header\n");
+        return 0;
+    }
+    if (base_size != base->st_size || base_mtime != base->st_mtime) {
+        errlog("READ_DELTA_FILE: Delta was written against a database of size %" PRIdN
+               " modified at %" PRIdN ", not %" PRIdN " at %" PRIdN "\n",
+               base_size, base_mtime, (Num) base->st_size, (Num) base->st_mtime);
+        return 0;
+    }
+
+    oklog("LOADING: Applying checkpoint delta ...\n");
+
+    if (dbio_scanf("%" SCNdN "\n", &nusers) != 1) {
+        errlog("READ_DELTA_FILE: Bad number of users\n");
+        return 0;
+    }
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+        user_list.v.list[i].type = TYPE_OBJ;
+        user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    free_var(db_all_users());
+    dbpriv_set_all_users(user_list);
+
+    if (!read_values_pending_finalization()) {
+        errlog("READ_DELTA_FILE: Can't read values pending finalization.\n");
+        return 0;
+    }
+
+    discard_task_queue();
+    if (!read_task_queue()) {
+        errlog("READ_DELTA_FILE: Can't read task queue.\n");
+        return 0;
+    }
+
+    if (!read_active_connections()) {
+        errlog("READ_DELTA_FILE: Can't read active connections.\n");
+        return 0;
+    }
+
+    if (dbio_scanf("%" SCNdN " %" SCNdN "\n", &last_oid, &nobjs) != 2) {
+        errlog("READ_DELTA_FILE: Bad object count\n");
+        return 0;
+    }
+    dbpriv_set_last_used_objid(last_oid);
+
+    oklog("LOADING: Reading %" PRIdN " changed object%s ...\n", nobjs, nobjs != 1 ? "s" : "");
+    for (i = 1; i <= nobjs; i++) {
+        if (dbio_scanf("#%" SCNdN, &oid) != 1 || oid < 0 || oid > last_oid) {
+            errlog("READ_DELTA_FILE: Bad object header, i = %" PRIdN ".\n", i);
+            return 0;
+        }
+        dbio_read_line(s, sizeof(s));
+        if (strcmp(s, " recycled\n") == 0)
+            dbpriv_forget_object(oid);
+        else if (strcmp(s, "\n") == 0) {
+            Object *o = dbpriv_replace_object(oid);
+
+            dbpriv_assign_nonce(o);
+            ng_read_object_fields(o);
+        } else {
+            errlog("READ_DELTA_FILE: Bad object #%" PRIdN ".\n", oid);
+            return 0;
+        }
+    }
+
+    if (!ng_validate_hierarchies()) {
+        errlog("READ_DELTA_FILE: Errors in object hierarchies.\n");
+        return 0;
+    }
+
+    if (dbio_scanf("%" SCNdN "\n", &nprogs) != 1) {
+        errlog("READ_DELTA_FILE: Bad verb count header\n");
+        return 0;
+    }
+    if (!read_verb_programs(nprogs))
+        return 0;
+
+    oklog("LOADING: Checkpoint delta applied\n");
+
+    return 1;
+}
+
+
+/*********** Write-ahead journal ***********/
+
+#ifdef WRITE_AHEAD_JOURNAL
+
+/* Between checkpoints, every object that changes is appended to the
+ * journal (`<database>.journal.<n>') in its saved form, along with the
+ * source of those of its verbs reprogrammed since (see
+ * `journal_write_object()'), in group commits of everything that
+ * changed since the last one.  Each commit is prefixed with its length, so a
+ * commit torn by a crash is recognized and dropped.  A new segment is
+ * started as each checkpoint snapshot is taken, and the checkpointer
+ * removes the older segments once its dump is safely on disk.
+ *
+ * Segments are written next to the output database, and are replayed
+ * from there even if the output database has since been moved into
+ * place as the input.  So that they are only replayed on top of the
+ * checkpoint they follow, `<database>.journal' lists the checkpoints
+ * (by the size and modification time of the full dump, or of the delta
+ * if there is one) the remaining segments can follow, with the first
+ * segment that follows each.
+ *
+ * Replaying those segments in order on top of the last checkpoint (and
+ * its delta) brings every object up to its state as of the last
+ * commit; an object's last image always postdates any checkpoint the
+ * segments survive alongside.  Tasks and connections are not journaled
+ * and come from the checkpoint.
+ *
+ * Commits are synced by a thread of their own, so that the server only
+ * waits for them to be written, not for the disk.  A commit may thus be
+ * lost to a crash for up to one sync longer than otherwise.  A sync
+ * that fails breaks the journal off at the next commit.
+ *
+ * Like deltas, the journal can't hold anonymous objects or WAIFs.  A
+ * commit that would need to marks the segment broken, and journaling
+ * stops until the next checkpoint starts a new segment.
+ */
+
+static const char *journal_header_format_string
+    = "** LambdaMOO Journal, Format Version %u **\n";
+
+static FILE *journal = nullptr;
+static Num journal_segment = 0;
+static time_t last_commit = 0;
+static Var journaled_users;
+
+static char *
+journal_segment_name(const char *db_name, Num segment)
+{
+    Stream *s = new_stream(100);
+    char *name;
+
+    stream_printf(s, "%s.journal.%" PRIdN, db_name, segment);
+    name = str_dup(stream_contents(s));
+    free_stream(s);
+
+    return name;
+}
+
+/* Returns the numbers of the journal segments next to `db_name', in
+ * order.
+ */
+static std::vector<Num>
+journal_segments(const char *db_name)
+{
+    std::vector<Num> segments;
+    Stream *s = new_stream(100);
+    glob_t g;
+    size_t i, prefix;
+
+    stream_printf(s, "%s.journal.*", db_name);
+    prefix = stream_length(s) - 1;
+    if (glob(stream_contents(s), 0, nullptr, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; i++) {
+            char *end;
+            Num n = strtol(g.gl_pathv[i] + prefix, &end, 10);
+
+            if (*end == '\0' && end != g.gl_pathv[i] + prefix)
+                segments.push_back(n);
+        }
+        globfree(&g);
+    }
+    free_stream(s);
+
+    std::sort(segments.begin(), segments.end());
+
+    return segments;
+}
+
+typedef struct journal_base {
+    Num size, mtime;            /* of the checkpoint */
+    Num first;                  /* first segment that follows it */
+} journal_base;
+
+static char *
+journal_bases_name(const char *suffix)
+{
+    Stream *s = new_stream(100);
+    char *name;
+
+    stream_printf(s, "%s.journal%s", dump_db_name, suffix);
+    name = str_dup(stream_contents(s));
+    free_stream(s);
+
+    return name;
+}
+
+static std::vector<journal_base>
+read_journal_bases(void)
+{
+    std::vector<journal_base> bases;
+    char *name = journal_bases_name("");
+    FILE *f = fopen(name, "r");
+    journal_base b;
+
+    if (f) {
+        while (fscanf(f, "%" SCNdN " %" SCNdN " %" SCNdN "\n", &b.size, &b.mtime, &b.first) == 3)
+            bases.push_back(b);
+        fclose(f);
+    }
+    free_str(name);
+
+    return bases;
+}
+
+static void
+write_journal_bases(const std::vector<journal_base>& bases)
+{
+    char *name = journal_bases_name("");
+    char *temp_name = journal_bases_name(".tmp");
+    FILE *f = fopen(temp_name, "w");
+
+    if (f) {
+        for (const journal_base& b : bases)
+            fprintf(f, "%" PRIdN " %" PRIdN " %" PRIdN "\n", b.size, b.mtime, b.first);
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0
+                || rename(temp_name, name) != 0)
+            log_perror("Recording the journal's checkpoint");
+    } else
+        log_perror("Recording the journal's checkpoint");
+    free_str(temp_name);
+    free_str(name);
+}
+
+static journal_base
+make_journal_base(const struct stat *st, Num first)
+{
+    journal_base b;
+
+    b.size = st->st_size;
+    b.mtime = st->st_mtime;
+    b.first = first;
+
+    return b;
+}
+
+static std::mutex journal_sync_mutex;
+static std::condition_variable journal_sync_cond;
+static int journal_sync_fd = -1;        /* segment waiting to be synced */
+static bool journal_syncing = false;
+static bool journal_sync_failed = false;
+
+static void
+journal_syncer(void)
+{
+    std::unique_lock<std::mutex> lock(journal_sync_mutex);
+
+    for (;;) {
+        journal_sync_cond.wait(lock, [] { return journal_sync_fd >= 0; });
+
+        int fd = journal_sync_fd;
+
+        journal_sync_fd = -1;
+        journal_syncing = true;
+        lock.unlock();
+        bool failed = fsync(fd) != 0;
+        lock.lock();
+        journal_syncing = false;
+        if (failed)
+            journal_sync_failed = true;
+        journal_sync_cond.notify_all();
+    }
+}
+
+static void
+request_journal_sync(int fd)
+{
+    static std::once_flag started;
+
+    std::call_once(started, [] { std::thread(journal_syncer).detach(); });
+
+    std::lock_guard<std::mutex> lock(journal_sync_mutex);
+    journal_sync_fd = fd;
+    journal_sync_cond.notify_all();
+}
+
+/* Waits until everything written to the journal so far is synced (or
+ * failed to be), so that the segment can be closed.  Returns false if a
+ * sync failed since the last call.
+ */
+static bool
+wait_for_journal_sync(void)
+{
+    std::unique_lock<std::mutex> lock(journal_sync_mutex);
+    bool ok;
+
+    journal_sync_cond.wait(lock, [] { return journal_sync_fd < 0 && !journal_syncing; });
+    ok = !journal_sync_failed;
+    journal_sync_failed = false;
+
+    return ok;
+}
+
+/* Returns false if a sync failed since the last call, without waiting. */
+static bool
+journal_synced(void)
+{
+    std::lock_guard<std::mutex> lock(journal_sync_mutex);
+    bool ok = !journal_sync_failed;
+
+    journal_sync_failed = false;
+
+    return ok;
+}
+
+/* Writes the object and the programs of its verbs edited since the
+ * last commit.  If some of its verbs weren't, the count of programs is
+ * written as -1 - n, and those verbs keep the programs they had; if all
+ * were (as after a verb is deleted), every program is written, as at a
+ * checkpoint, and a verb not among them has none.
+ */
+static void
+journal_write_object(Objid oid)
+{
+    Verbdef *v;
+    int nprogs = 0, vcount = 0;
+    bool all = true;
+
+    ng_write_object(oid);
+    if (!valid(oid))
+        return;
+
+    for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next)
+        if (!v->edited)
+            all = false;
+        else if (v->program || v->source)
+            nprogs++;
+    dbio_write_num(all ? nprogs : -1 - nprogs);
+
+    for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next, vcount++) {
+        if (v->edited && (v->program || v->source)) {
+            dbio_write_num(vcount);
+            if (v->program)
+                dbio_write_program(v->program);
+            else
+                dbio_write_program_text(v->source);
+        }
+        v->edited = false;
+    }
+}
+
+static void
+stop_journal(const char *why)
+{
+    errlog("JOURNAL: %s; journaling stops until the next checkpoint\n", why);
+    wait_for_journal_sync();
+    /* replay must not go past this point */
+    fprintf(journal, "broken\n");
+    fflush(journal);
+    fsync(fileno(journal));
+    fclose(journal);
+    journal = nullptr;
+}
+
+/* Appends everything that changed since the last commit to the journal
+ * and has the syncer send it on to the disk.
+ */
+static void
+commit_journal(void)
+{
+    Var changed, users;
+    int users_changed, i;
+    char *buf = nullptr;
+    size_t len = 0;
+    FILE *mem;
+    int status = 1;
+
+    last_commit = time(nullptr);
+    if (!journal)
+        return;
+    if (!journal_synced()) {
+        stop_journal("Can't sync the last commit");
+        return;
+    }
+
+    changed = dbpriv_take_changes();
+    users = db_all_users();
+    users_changed = !equality(users, journaled_users, 1);
+    if (listlength(changed) == 0 && !users_changed) {
+        free_var(changed);
+        return;
+    }
+
+    if (!(mem = open_memstream(&buf, &len))) {
+        free_var(changed);
+        stop_journal("Can't buffer a commit");
+        return;
+    }
+    dbpriv_set_dbio_output(mem);
+    dbpriv_refuse_shared_values(1);
+    try {
+        dbio_printf("%" PRIdN " %" PRIdN " %d\n", db_last_used_objid(),
+                    (Num)listlength(changed), users_changed);
+        if (users_changed) {
+            dbio_printf("%" PRIdN "\n", (Num)listlength(users));
+            for (i = 1; i <= listlength(users); i++)
+                dbio_write_objid(users.v.list[i].v.obj);
+        }
+        for (i = 1; i <= listlength(changed); i++)
+            journal_write_object(changed.v.list[i].v.obj);
+        dbpriv_flush_dbio_output();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+        status = 0;
+    }
+    catch (dbpriv_dbio_shared_value& exception) {
+        status = -1;
+    }
+    dbpriv_refuse_shared_values(0);
+    fclose(mem);
+    free_var(changed);
+
+    if (status > 0) {
+        fprintf(journal, "commit %zu\n", len);
+        fwrite(buf, 1, len, journal);
+        if (fflush(journal) != 0)
+            status = 0;
+        else
+            request_journal_sync(fileno(journal));
+    }
+    free(buf);
+
+    if (status > 0) {
+        if (users_changed) {
+            free_var(journaled_users);
+            journaled_users = var_ref(users);
+        }
+    } else if (status < 0)
+        stop_journal("A change refers to anonymous objects or WAIFs");
+    else
+        stop_journal("Can't write a commit");
+}
+
+static void
+open_journal_segment(void)
+{
+    char *name = journal_segment_name(dump_db_name, ++journal_segment);
+
+    if ((journal = fopen(name, "w")) != nullptr) {
+        fprintf(journal, journal_header_format_string, current_db_version);
+        fflush(journal);
+    } else
+        log_perror("Opening journal segment");
+    free_str(name);
+
+    /* the new segment starts from the state as of now */
+    dbpriv_track_changes(1);
+    free_var(dbpriv_take_changes());
+    free_var(journaled_users);
+    journaled_users = var_ref(db_all_users());
+    last_commit = time(nullptr);
+}
+
+/* Commits what is pending to the current segment and closes it, opening
+ * the next one if `reopen'.  Returns the number of the segment closed:
+ * once a checkpoint taken now is on disk, it and all earlier segments
+ * can go.
+ */
+static Num
+rotate_journal(int reopen)
+{
+    Num segment = journal_segment;
+
+    commit_journal();
+    if (journal) {
+        if (!wait_for_journal_sync())
+            errlog("JOURNAL: Can't sync the last commit of segment %" PRIdN "\n", segment);
+        fclose(journal);
+        journal = nullptr;
+    }
+    if (reopen)
+        open_journal_segment();
+
+    return segment;
+}
+
+static void
+remove_journal_segments(Num through)
+{
+    for (Num segment : journal_segments(dump_db_name)) {
+        if (segment > through)
+            break;
+
+        char *name = journal_segment_name(dump_db_name, segment);
+
+        remove(name);
+        free_str(name);
+    }
+}
+
+static int
+replay_journal_commit(void)
+{
+    Num i, j, nobjs, nprogs, nusers, vnum;
+    Objid oid, last_oid;
+    int users_changed;
+    char s[20];
+
+    if (dbio_scanf("%" SCNdN " %" SCNdN " %d\n", &last_oid, &nobjs, &users_changed) != 3)
+        return 0;
+
+    if (users_changed) {
+        Var user_list;
+
+        nusers = dbio_read_num();
+        user_list = new_list(nusers);
+        for (i = 1; i <= nusers; i++)
+            user_list.v.list[i] = Var::new_obj(dbio_read_objid());
+        free_var(db_all_users());
+        dbpriv_set_all_users(user_list);
+    }
+
+    dbpriv_set_last_used_objid(last_oid);
+
+    for (i = 1; i <= nobjs; i++) {
+        if (dbio_scanf("#%" SCNdN, &oid) != 1 || oid < 0 || oid > last_oid)
+            return 0;
+        dbio_read_line(s, sizeof(s));
+        if (strcmp(s, " recycled\n") == 0) {
+            dbpriv_forget_object(oid);
+            continue;
+        } else if (strcmp(s, "\n") != 0)
+            return 0;
+
+        /* the programs it had, for verbs the commit leaves alone */
+        std::vector<std::pair<Program *, const char *>> kept;
+        Object *o = dbpriv_find_object(oid);
+        Verbdef *v;
+
+        if (o)
+            for (v = o->verbdefs; v; v = v->next) {
+                kept.emplace_back(v->program, v->source);
+                v->program = nullptr;
+                v->source = nullptr;
+            }
+
+        o = dbpriv_replace_object(oid);
+        dbpriv_assign_nonce(o);
+        ng_read_object_fields(o);
+
+        if ((nprogs = dbio_read_num()) < 0) {
+            nprogs = -1 - nprogs;
+            for (v = o->verbdefs, j = 0; v && j < (Num)kept.size(); v = v->next, j++) {
+                v->program = kept[j].first;
+                v->source = kept[j].second;
+                kept[j] = {nullptr, nullptr};
+            }
+        }
+        for (auto& k : kept) {
+            if (k.first)
+                free_program(k.first);
+            if (k.second)
+                free_str(k.second);
+        }
+
+        for (j = 0; j < nprogs; j++) {
+            const char *text;
+            db_verb_handle h;
+
+            vnum = dbio_read_num();
+            if (!(text = dbio_read_program_text()))
+                return 0;
+            h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);
+            if (!h.ptr) {
+                free_str(text);
+                return 0;
+            }
+            dbpriv_set_verb_source(h, text);
+        }
+    }
+
+    return 1;
+}
+
+/* Returns true iff anything follows the header of the given segment;
+ * one opened just before a crash holds nothing to lose.
+ */
+static bool
+journal_segment_has_commits(const char *db_name, Num segment)
+{
+    char *name = journal_segment_name(db_name, segment);
+    FILE *f = fopen(name, "r");
+    bool found = false;
+    int c;
+
+    if (f) {
+        while ((c = fgetc(f)) != EOF && c != '\n')
+            ;
+        found = c != EOF && fgetc(f) != EOF;
+        fclose(f);
+    }
+    free_str(name);
+
+    return found;
+}
+
+/* Replays the journal segments that follow the checkpoint just loaded,
+ * `loaded' (the full dump or the delta applied to it), and sets `*first'
+ * to the first of them, or to 0 if there are none.  Returns 0 if one is
+ * unreadable, or if there are commits that don't follow `loaded' (they
+ * would be lost once the next checkpoint is written).
+ */
+static int
+replay_journal(const struct stat *loaded, Num *first)
+{
+    const char *db_name = dump_db_name;
+    std::vector<Num> segments = journal_segments(db_name);
+    Num ncommits = 0;
+    int broken = 0;
+
+    *first = 0;
+    for (const journal_base& b : read_journal_bases())
+        if (b.size == loaded->st_size && b.mtime == loaded->st_mtime)
+            *first = b.first;
+    if (!*first) {
+        for (Num segment : segments)
+            if (journal_segment_has_commits(db_name, segment)) {
+                errlog("REPLAY_JOURNAL: The journal next to %s doesn't follow this checkpoint\n",
+                       db_name);
+                return 0;
+            }
+        return 1;
+    }
+    segments.erase(segments.begin(),
+                   std::lower_bound(segments.begin(), segments.end(), *first));
+
+    for (Num segment : segments) {
+        char *name = journal_segment_name(db_name, segment);
+        FILE *f = fopen(name, "r");
+        struct stat st;
+        unsigned version;
+        size_t len;
+        char tail[20];
+
+        if (!f || fstat(fileno(f), &st) < 0) {
+            log_perror("Opening journal segment");
+            free_str(name);
             return 0;
         }
-        if (!valid(oid)) {
-            errlog("READ_DB_FILE: Verb for non-existant object: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+        oklog("LOADING: Replaying %s ...\n", name);
+        dbpriv_set_dbio_input(f);
+        if (dbio_scanf(journal_header_format_string, &version) != 1
+                || version != current_db_version) {
+            errlog("REPLAY_JOURNAL: Unknown journal format in %s\n", name);
+            fclose(f);
+            free_str(name);
             return 0;
         }
-        h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);  /* DB file is 0-based. */
-        if (!h.ptr) {
-            errlog("READ_DB_FILE: Unknown verb index: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
-            return 0;
+        dbio_input_version = (DB_Version)version;
+
+        while (dbio_scanf("commit %zu\n", &len) == 1) {
+            if (dbpriv_dbio_input_offset() + (long)len > st.st_size)
+                break;      /* torn by a crash; nothing follows */
+            if (!replay_journal_commit()) {
+                errlog("REPLAY_JOURNAL: Bad commit in %s\n", name);
+                fclose(f);
+                free_str(name);
+                return 0;
+            }
+            ncommits++;
+        }
+        if (dbio_scanf("%19s", tail) == 1 && strcmp(tail, "broken") == 0)
+            broken = 1;
+
+        fclose(f);
+        free_str(name);
+        if (broken) {
+            oklog("LOADING: Journal was broken off; later segments are ignored\n");
+            break;
+        }
+    }
+
+    if (ncommits && !ng_validate_hierarchies()) {
+        errlog("REPLAY_JOURNAL: Errors in object hierarchies.\n");
+        return 0;
+    }
+    if (!segments.empty())
+        oklog("LOADING: Replayed %" PRIdN " journal commit%s\n", ncommits, ncommits != 1 ? "s" : "");
+
+    return 1;
+}
+
+#endif /* WRITE_AHEAD_JOURNAL */
+
+
+/*********** Checkpoint statistics ***********/
+
+/* Where the time of a checkpoint goes.  Whoever writes it (the server
+ * itself, a forked checkpointer or a thread) charges the time to each
+ * phase as it ends; a forked checkpointer sends its figures back through
+ * a pipe just before it exits.
+ */
+
+enum checkpoint_phase {
+    PHASE_FINALIZATION, PHASE_TASKS, PHASE_CONNECTIONS, PHASE_OBJECTS,
+    PHASE_PROGRAMS, PHASE_FSYNC, PHASE_RENAME, N_PHASES
+};
+
+static const char *phase_names[N_PHASES] =
+{"finalization", "tasks", "connections", "objects", "programs", "fsync", "rename"};
+
+enum checkpoint_method {
+    METHOD_UNFORKED, METHOD_FORKED, METHOD_THREADED
+};
+
+static const char *method_names[] =
+{"unforked", "forked", "threaded"};
+
+typedef struct checkpoint_stats {
+    time_t started;             /* 0 if there's nothing to report */
+    double begun;               /* the same, on the monotonic clock */
+    double pause;               /* how long the server stood still */
+    double elapsed;
+    double phases[N_PHASES];
+    enum checkpoint_method method;
+    enum dbio_format format;
+    int delta;
+    int success;
+    Num bytes;
+    Num rss;                    /* in kB, once the writing was done */
+    Num cow_pages;              /* pages a forked checkpointer no longer
+                                 * shared with the server by then */
+} checkpoint_stats;
+
+static checkpoint_stats last_stats;     /* of the last one to finish */
+static checkpoint_stats pending_stats;  /* of the one being started */
+static int stats_pipe = -1;
+
+static thread_local checkpoint_stats *recording = nullptr;
+static thread_local double phase_begun;
+
+static double
+monotonic_seconds(void)
+{
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+record_stats(checkpoint_stats *stats)
+{
+    recording = stats;
+    phase_begun = monotonic_seconds();
+}
+
+/* Charges the time since the last phase ended to `phase', if this thread
+ * is recording.
+ */
+static void
+time_phase(enum checkpoint_phase phase)
+{
+    double now;
+
+    if (!recording)
+        return;
+    now = monotonic_seconds();
+    recording->phases[phase] += now - phase_begun;
+    phase_begun = now;
+}
+
+static void
+begin_stats(enum checkpoint_method method, enum dbio_format format, int delta)
+{
+    memset(&pending_stats, 0, sizeof(pending_stats));
+    pending_stats.started = time(nullptr);
+    pending_stats.begun = monotonic_seconds();
+    pending_stats.method = method;
+    pending_stats.format = format;
+    pending_stats.delta = delta;
+    record_stats(&pending_stats);
+}
+
+/* Called by the writer once it's done; Linux only. */
+static void
+measure_memory(checkpoint_stats *stats)
+{
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[128];
+    long kb, unshared = 0;
+
+    if (!f)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Rss: %ld", &kb) == 1)
+            stats->rss = kb;
+        else if (sscanf(line, "Private_Clean: %ld", &kb) == 1
+                 || sscanf(line, "Private_Dirty: %ld", &kb) == 1)
+            unshared += kb;
+    }
+    fclose(f);
+
+    if (stats->method == METHOD_FORKED)
+        stats->cow_pages = unshared * 1024 / sysconf(_SC_PAGESIZE);
+}
+
+static void
+end_stats(checkpoint_stats *stats, int success)
+{
+    stats->success = success;
+    stats->elapsed = monotonic_seconds() - stats->begun;
+    if (stats->method == METHOD_UNFORKED)
+        stats->pause = stats->elapsed;
+    if (recording == stats)
+        recording = nullptr;
+}
+
+#ifndef UNFORKED_CHECKPOINTS
+/* Called on either side of forking a checkpointer, which gets the write
+ * end of a pipe to send its figures back on.
+ */
+static void
+fork_stats(enum Fork_Result result, int fds[2])
+{
+    switch (result) {
+        case FORK_PARENT:
+            pending_stats.pause = monotonic_seconds() - pending_stats.begun;
+            recording = nullptr;
+            if (fds[0] >= 0) {
+                close(fds[1]);
+                fcntl(fds[0], F_SETFL, O_NONBLOCK);
+                fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+                stats_pipe = fds[0];
+            }
+            break;
+        case FORK_CHILD:
+            if (fds[0] >= 0) {
+                close(fds[0]);
+                stats_pipe = fds[1];
+            }
+            break;
+        case FORK_ERROR:
+            recording = nullptr;
+            if (fds[0] >= 0) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            break;
+    }
+}
+#endif /* !UNFORKED_CHECKPOINTS */
+
+/* Picks up the figures of a forked checkpointer that has exited. */
+static void
+collect_forked_stats(void)
+{
+    /* static, like the rest; nothing about a checkpoint lives on the stack */
+    static checkpoint_stats received;
+    ssize_t n;
+
+    if (stats_pipe < 0)
+        return;
+    n = read(stats_pipe, &received, sizeof(received));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;                 /* still writing */
+    if (n == sizeof(received)) {
+        received.pause = pending_stats.pause;
+        last_stats = received;
+    }
+    close(stats_pipe);
+    stats_pipe = -1;
+}
+
+#ifndef UNFORKED_CHECKPOINTS
+/* Forked checkpointers mustn't overlap.  One that finished after a later
+ * one had started would install an older state over the newer one's,
+ * or leave behind a delta against a full dump that's no longer there
+ * (and forget journal segments it doesn't cover).  The pipe a forked
+ * checkpointer reports on stays open, with nothing to read, until it
+ * has installed its dump.
+ */
+static int
+forked_checkpointer_running(void)
+{
+    collect_forked_stats();
+
+    return stats_pipe >= 0;
+}
+
+static void
+wait_for_forked_checkpointer(void)
+{
+    if (stats_pipe >= 0) {
+        fcntl(stats_pipe, F_SETFL, 0);
+        while (forked_checkpointer_running()) {
+            /* interrupted; try again */
+        }
+    }
+}
+#endif /* !UNFORKED_CHECKPOINTS */
+
+/*********** File-level Output ***********/
+
+/* Is the saved form of `oid' in a checkpoint that only covers changes
+ * made after the snapshot of epoch `since'?  (Recycled numbers always
+ * are, so that a delta records them.)
+ */
+static int
+changed_since(Objid oid, unsigned int since)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    return !o || o->dirty > since;
+}
+
+static Num
+count_object_programs(Object *o)
+{
+    Verbdef *v;
+    Num n = 0;
+
+    for (v = o->verbdefs; v; v = v->next)
+        if (v->program || v->source)
+            n++;
+
+    return n;
+}
+
+/* Writes the programs of the verbs on object `oid', which is `o', counting
+ * them in `*written' out of `nprogs' and logging progress for `reason'
+ * (unless that's null).
+ */
+static void
+write_object_programs(Objid oid, Object *o, const char *reason, Num *written, Num nprogs)
+{
+    Verbdef *v;
+    int vcount = 0;
+
+    for (v = o->verbdefs; v; v = v->next) {
+        if (v->program || v->source) {
+#ifdef PERSISTENT_BYTECODE
+            int compiled = v->program != nullptr;
+#else
+            int compiled = 0;
+#endif
+            dbio_printf("#%" PRIdN ":%" PRIdN " %d\n", oid, vcount, compiled);
+            if (v->program)
+                dbio_write_program(v->program);
+            else
+                dbio_write_program_text(v->source);
+            if (compiled)
+                dbio_write_program_bytecode(v->program);
+            if (++*written % 5000 == 0 || *written == nprogs)
+                if (reason)
+                    oklog("%s: Done writing %" PRIdN " verb programs ...\n",
+                          reason, *written);
+        }
+        vcount++;
+    }
+}
+
+/* Writes the programs of every verb on the objects up to `max_oid' that
+ * changed since epoch `since' (0 for all of them).
+ */
+static void
+write_verb_programs(const char *reason, Objid max_oid, unsigned int since)
+{
+    Objid oid;
+    Num i = 0, nprogs = 0;
+
+    for (oid = 0; oid <= max_oid; oid++) {
+        if (valid(oid) && changed_since(oid, since))
+            nprogs += count_object_programs(dbpriv_find_object(oid));
+    }
+
+    dbio_printf("%" PRIdN "\n", nprogs);
+    dbio_printf("%u\n", dbio_bytecode_fingerprint());
+
+    oklog("%s: Writing %" PRIdN " MOO verb programs ...\n", reason, nprogs);
+    for (oid = 0; oid <= max_oid; oid++) {
+        if (valid(oid) && changed_since(oid, since))
+            write_object_programs(oid, dbpriv_find_object(oid), reason, &i, nprogs);
+    }
+}
+
+static int
+write_db_file(const char *reason)
+{
+    Objid oid;
+    Objid last_oid = db_last_used_objid(), max_oid = -1;
+    Var user_list;
+    int i;
+    volatile int success = 1;
+
+    try {
+        waif_before_saving();
+        dbio_printf(header_format_string, current_db_version);
+
+        user_list = db_all_users();
+
+        dbio_printf("%" PRIdN "\n", listlength(user_list));
+
+        for (i = 1; i <= user_list.v.list[0].v.num; i++)
+            dbio_write_objid(user_list.v.list[i].v.obj);
+
+        oklog("%s: Writing values pending finalization ...\n", reason);
+        write_values_pending_finalization();
+        time_phase(PHASE_FINALIZATION);
+
+        oklog("%s: Writing forked and suspended tasks ...\n", reason);
+        write_task_queue();
+        time_phase(PHASE_TASKS);
+
+        oklog("%s: Writing list of formerly active connections ...\n", reason);
+        write_active_connections();
+        time_phase(PHASE_CONNECTIONS);
+
+        while (last_oid > max_oid) {
+            dbio_printf("%" PRIdN "\n", last_oid - max_oid);
+
+            oklog("%s: Writing %" PRIdN " objects ...\n", reason, last_oid - max_oid);
+            for (oid = max_oid + 1; oid <= last_oid; oid++) {
+                ng_write_object(oid);
+                if ((oid + 1) % 10000 == 0 || oid == last_oid)
+                    oklog("%s: Done writing %" PRIdN " objects ...\n", reason, oid + 1);
+            }
+            max_oid = last_oid;
+            last_oid = db_last_used_objid();
+        }
+
+        dbio_printf("%" PRIdN "\n", 0);
+        time_phase(PHASE_OBJECTS);
+
+        write_verb_programs(reason, max_oid, 0);
+
+        waif_after_saving();
+        dbpriv_flush_dbio_output();
+        time_phase(PHASE_PROGRAMS);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+        success = 0;
+    }
+
+    return success;
+}
+
+#ifdef INCREMENTAL_CHECKPOINTS
+
+/* Returns 1 on success, 0 on failure and -1 if the delta would have to
+ * hold anonymous objects or WAIFs (see above).
+ */
+static int
+write_delta_file(const char *reason, unsigned int since)
+{
+    Objid oid, last_oid = db_last_used_objid();
+    Num nobjs = 0;
+    Var user_list;
+    struct stat st;
+    int i;
+    volatile int success = 1;
+
+    if (stat(dump_db_name, &st) < 0) {
+        oklog("%s: %s is missing\n", reason, dump_db_name);
+        return -1;
+    }
+
+    dbpriv_refuse_shared_values(1);
+    try {
+        dbio_printf(delta_header_format_string, current_db_version);
+        dbio_printf("%" PRIdN " %" PRIdN "\n", (Num)st.st_size, (Num)st.st_mtime);
+
+        user_list = db_all_users();
+
+        dbio_printf("%" PRIdN "\n", listlength(user_list));
+
+        for (i = 1; i <= user_list.v.list[0].v.num; i++)
+            dbio_write_objid(user_list.v.list[i].v.obj);
+
+        oklog("%s: Writing values pending finalization ...\n", reason);
+        write_values_pending_finalization();
+        time_phase(PHASE_FINALIZATION);
+
+        oklog("%s: Writing forked and suspended tasks ...\n", reason);
+        write_task_queue();
+        time_phase(PHASE_TASKS);
+
+        oklog("%s: Writing list of formerly active connections ...\n", reason);
+        write_active_connections();
+        time_phase(PHASE_CONNECTIONS);
+
+        for (oid = 0; oid <= last_oid; oid++)
+            if (changed_since(oid, since))
+                nobjs++;
+
+        dbio_printf("%" PRIdN " %" PRIdN "\n", last_oid, nobjs);
+
+        oklog("%s: Writing %" PRIdN " changed objects ...\n", reason, nobjs);
+        for (oid = 0; oid <= last_oid; oid++)
+            if (changed_since(oid, since))
+                ng_write_object(oid);
+        time_phase(PHASE_OBJECTS);
+
+        write_verb_programs(reason, last_oid, since);
+        dbpriv_flush_dbio_output();
+        time_phase(PHASE_PROGRAMS);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+        success = 0;
+    }
+    catch (dbpriv_dbio_shared_value& exception) {
+        oklog("%s: A delta can't refer to anonymous objects or WAIFs\n", reason);
+        success = -1;
+    }
+    dbpriv_refuse_shared_values(0);
+
+    return success;
+}
+
+/* After each full dump, `<database>.base' records the epoch of its
+ * snapshot along with the size and modification time of the file, so
+ * that later checkpoints know what a delta has to cover.  `run_id'
+ * keeps a server from trusting epochs left behind by an earlier run.
+ */
+static long run_id;
+static int deltas_since_full = 0;
+
+static char *
+base_db_name(void)
+{
+    Stream *s = new_stream(100);
+    char *name;
+
+    stream_printf(s, "%s.base", dump_db_name);
+    name = str_dup(stream_contents(s));
+    free_stream(s);
+
+    return name;
+}
+
+static void
+record_base_epoch(unsigned int epoch)
+{
+    char *name = base_db_name();
+    struct stat st;
+    FILE *f;
+
+    if (stat(dump_db_name, &st) == 0 && (f = fopen(name, "w")) != nullptr) {
+        fprintf(f, "%ld %u %" PRIdN " %" PRIdN "\n", run_id, epoch,
+                (Num)st.st_size, (Num)st.st_mtime);
+        fclose(f);
+    }
+    free_str(name);
+}
+
+/* Returns the epoch of the snapshot in the full dump now at
+ * `dump_db_name', or 0 if it isn't known.
+ */
+static unsigned int
+base_epoch(void)
+{
+    char *name = base_db_name();
+    struct stat st;
+    FILE *f;
+    long id;
+    unsigned int epoch = 0;
+    Num size, mtime;
+
+    if (stat(dump_db_name, &st) == 0 && (f = fopen(name, "r")) != nullptr) {
+        if (fscanf(f, "%ld %u %" SCNdN " %" SCNdN, &id, &epoch, &size, &mtime) != 4
+                || id != run_id || size != st.st_size || mtime != st.st_mtime)
+            epoch = 0;
+        fclose(f);
+    }
+    free_str(name);
+
+    return epoch;
+}
+
+/* Decides whether the next checkpoint can be a delta against the full
+ * dump with snapshot epoch `base', or should compact everything into a
+ * new full dump.
+ */
+static int
+want_delta_checkpoint(unsigned int base)
+{
+    char *name;
+    struct stat st, dst;
+    int compact = 0;
+
+    if (!base || deltas_since_full >= server_int_option("full_checkpoint_interval",
+                                                        DEFAULT_FULL_CHECKPOINT_INTERVAL))
+        return 0;
+
+    /* deltas only grow; compact once they're half the size of the whole */
+    name = delta_db_name(dump_db_name);
+    if (stat(dump_db_name, &st) == 0 && stat(name, &dst) == 0)
+        compact = dst.st_size > st.st_size / 2;
+    free_str(name);
+
+    return !compact;
+}
+
+#endif /* INCREMENTAL_CHECKPOINTS */
+
+typedef enum {
+    DUMP_SHUTDOWN, DUMP_CHECKPOINT, DUMP_PANIC
+} Dump_Reason;
+const char *reason_names[] =
+{"DUMPING", "CHECKPOINTING", "PANIC-DUMPING"};
+
+/* Indexed by `enum dbio_format' */
+static const char *dump_format_names[] =
+{"text", "binary", "compressed"};
+static int forced_dump_format = -1;
+
+static int
+find_dump_format(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; name && i < sizeof(dump_format_names) / sizeof(*dump_format_names); i++)
+        if (!strcasecmp(name, dump_format_names[i]))
+            return i;
+    return -1;
+}
+
+static enum dbio_format
+dump_format(void)
+{
+    int format = forced_dump_format;
+
+    if (format < 0
+            && (format = find_dump_format(server_string_option("dump_format",
+                                                               DEFAULT_DUMP_FORMAT))) < 0) {
+        errlog("DUMP_FORMAT: Unknown $server_options.dump_format; writing text\n");
+        format = DBIO_TEXT;
+    }
+    return (enum dbio_format) format;
+}
+
+/* Puts the finished dump at `temp_name' in its place and forgets what it
+ * makes obsolete: for a full dump, the delta next to it; for any dump,
+ * journal segments up to `journaled'.  `epoch' is the epoch of its
+ * snapshot.
+ */
+static int
+install_dump(Dump_Reason reason, const char *temp_name, int delta,
+             unsigned int epoch, Num journaled)
+{
+    char *final_name;
+    int success = 1;
+#ifdef WRITE_AHEAD_JOURNAL
+    struct stat st;
+    int journal_known = 0;
+
+    /* the later segments follow this dump once it's in place, and the
+     * earlier ones follow the last until then
+     */
+    if (reason != DUMP_PANIC && stat(temp_name, &st) == 0) {
+        std::vector<journal_base> bases = read_journal_bases();
+
+        bases.push_back(make_journal_base(&st, journaled + 1));
+        write_journal_bases(bases);
+        journal_known = 1;
+    }
+#endif
+
+    if (reason != DUMP_PANIC) {
+        final_name = delta ? delta_db_name(dump_db_name) : str_dup(dump_db_name);
+        remove(final_name);
+        if (rename(temp_name, final_name) != 0) {
+            log_perror("Renaming temporary dump file");
+            success = 0;
+        }
+        free_str(final_name);
+    }
+#ifdef INCREMENTAL_CHECKPOINTS
+    if (success && reason != DUMP_PANIC) {
+        if (delta)
+            deltas_since_full++;
+        else {
+            /* any delta next to it is now stale */
+            char *name = delta_db_name(dump_db_name);
+
+            record_base_epoch(epoch);
+            remove(name);
+            free_str(name);
+            deltas_since_full = 0;
         }
-        program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
-        if (!program) {
-            errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
-            return 0;
+    }
+#endif
+#ifdef WRITE_AHEAD_JOURNAL
+    if (success && journal_known)
+        write_journal_bases({make_journal_base(&st, journaled + 1)});
+    if (success && journaled)
+        remove_journal_segments(journaled);
+#endif
+    time_phase(PHASE_RENAME);
+
+    return success;
+}
+
+#ifdef THREADED_CHECKPOINTS
+
+/*********** Background checkpoints ***********/
+
+/* The snapshot of a background checkpoint is taken all at once, by the
+ * main thread: everything ahead of the objects is encoded into memory,
+ * and each object to be written is copied, sharing its values and verb
+ * programs by reference.  Values aren't changed in place while they are
+ * shared, so nothing the server does from then on changes the snapshot.
+ * A thread of its own then writes the snapshot out.
+ *
+ * A snapshot can't hold anonymous objects or WAIFs, which only keep
+ * their identity within a single file.  If it turns out to need them,
+ * the checkpoint (and every later one) is made by forking instead.
+ */
+
+typedef struct snapshot_entry {
+    Objid oid;
+    Object *o;                  /* a copy, or null if recycled */
+} snapshot_entry;
+
+typedef struct checkpoint_job {
+    char *temp_name;
+    enum dbio_format format;
+    unsigned int since;         /* base epoch of a delta, or 0 */
+    unsigned int epoch;
+    Num journaled;
+    char *prefix;               /* output ahead of the objects */
+    size_t prefix_size;
+    Objid last_oid;
+    std::vector<snapshot_entry> entries;
+    unsigned fingerprint;
+    std::thread thread;
+    std::atomic<bool> done;
+    int success;                /* or -1 if it needed a shared value */
+    checkpoint_stats stats;
+} checkpoint_job;
+
+static checkpoint_job *checkpointer = nullptr;
+static int shared_values_seen = 0;
+
+static Object *
+copy_object(Object *o)
+{
+    Object *c = (Object *)mymalloc(sizeof(Object), M_OBJECT);
+    Verbdef *v, **prevv;
+    int i;
+
+    *c = *o;
+    c->name = str_ref(o->name);
+    c->location = var_ref(o->location);
+    c->last_move = var_ref(o->last_move);
+    c->contents = var_ref(dbpriv_object_contents(o));
+    c->parents = var_ref(o->parents);
+    c->children = var_ref(dbpriv_object_children(o));
+    c->prop_index = nullptr;
+    c->waif_propdefs = nullptr;
+    c->contents_set = c->children_set = nullptr;
+    c->ancestors = none;
+
+    prevv = &(c->verbdefs);
+    for (v = o->verbdefs; v; v = v->next) {
+        Verbdef *cv = (Verbdef *)mymalloc(sizeof(Verbdef), M_VERBDEF);
+
+        *cv = *v;
+        cv->name = str_ref(v->name);
+        if (v->program) {
+            cv->program = program_ref(v->program);
+            /* decompiling it takes references to its literals */
+            for (unsigned j = 0; j < v->program->num_literals; j++)
+                share_var(v->program->literals[j]);
         }
-        db_set_verb_program(h, program);
-        if (i % 5000 == 0 || i == nprogs)
-            oklog("LOADING: Done reading %" PRIdN " verb program%s ...\n", i, i > 1 ? "s" : "");
+        if (v->source)
+            cv->source = str_ref(v->source);
+        *prevv = cv;
+        prevv = &(cv->next);
     }
+    *prevv = nullptr;
 
-    if (DBV_Anon > dbio_input_version) {
-        oklog("LOADING: Reading forked and suspended tasks ...\n");
-        if (!read_task_queue()) {
-            errlog("READ_DB_FILE: Can't read task queue.\n");
-            return 0;
+    c->propdefs.max_length = c->propdefs.cur_length = o->propdefs.cur_length;
+    c->propdefs.l = nullptr;
+    if (o->propdefs.cur_length) {
+        c->propdefs.l = (Propdef *)mymalloc(o->propdefs.cur_length * sizeof(Propdef), M_PROPDEF);
+        for (i = 0; i < o->propdefs.cur_length; i++) {
+            c->propdefs.l[i] = o->propdefs.l[i];
+            str_ref(c->propdefs.l[i].name);
         }
+    }
 
-        oklog("LOADING: Reading list of formerly active connections ...\n");
-        if (!read_active_connections()) {
-            errlog("DB_READ: Can't read active connections.\n");
-            return 0;
+    c->propval = nullptr;
+    if (o->nval) {
+        c->propval = (Pval *)mymalloc(o->nval * sizeof(Pval), M_PVAL);
+        for (i = 0; i < (int) o->nval; i++) {
+            c->propval[i] = o->propval[i];
+            var_ref(c->propval[i].var);
         }
     }
 
-    /* see db_objects.c */
-    dbpriv_after_load();
-    waif_after_loading();
+    return c;
+}
 
-    return 1;
+static void
+free_object_copy(Object *c)
+{
+    Verbdef *v, *next;
+    int i;
+
+    free_str(c->name);
+    free_var(c->location);
+    free_var(c->last_move);
+    free_var(c->contents);
+    free_var(c->parents);
+    free_var(c->children);
+
+    for (v = c->verbdefs; v; v = next) {
+        next = v->next;
+        free_str(v->name);
+        if (v->program)
+            free_program(v->program);
+        if (v->source)
+            free_str(v->source);
+        myfree(v, M_VERBDEF);
+    }
+
+    for (i = 0; i < c->propdefs.cur_length; i++)
+        free_str(c->propdefs.l[i].name);
+    if (c->propdefs.l)
+        myfree(c->propdefs.l, M_PROPDEF);
+
+    for (i = 0; i < (int) c->nval; i++)
+        free_var(c->propval[i].var);
+    if (c->propval)
+        myfree(c->propval, M_PVAL);
+
+    myfree(c, M_OBJECT);
 }
-
 
-/*********** File-level Output ***********/
+/* Runs in a thread of its own, touching nothing but `job'. */
+static void
+write_checkpoint(checkpoint_job *job)
+{
+    FILE *f = fopen(job->temp_name, "w");
+    Num nprogs = 0, written = 0;
+    int success = 0;
+
+    record_stats(&job->stats);
+    if (f) {
+        dbpriv_set_dbio_output(f);
+        dbpriv_refuse_shared_values(1);
+        try {
+            if (dbpriv_set_dbio_output_format(job->format)) {
+                dbpriv_write_dbio_encoded(job->prefix, job->prefix_size);
+
+                if (job->since)
+                    dbio_printf("%" PRIdN " %" PRIdN "\n", job->last_oid, (Num)job->entries.size());
+                else if (job->last_oid >= 0)
+                    dbio_printf("%" PRIdN "\n", job->last_oid + 1);
+                for (const snapshot_entry& e : job->entries)
+                    ng_write_object_record(e.oid, e.o);
+                if (!job->since)
+                    dbio_printf("%" PRIdN "\n", 0);
+                time_phase(PHASE_OBJECTS);
+
+                for (const snapshot_entry& e : job->entries)
+                    if (e.o)
+                        nprogs += count_object_programs(e.o);
+                dbio_printf("%" PRIdN "\n", nprogs);
+                dbio_printf("%u\n", job->fingerprint);
+                for (const snapshot_entry& e : job->entries)
+                    if (e.o)
+                        write_object_programs(e.oid, e.o, nullptr, &written, nprogs);
+
+                dbpriv_flush_dbio_output();
+                time_phase(PHASE_PROGRAMS);
+                success = fflush(f) == 0 && fsync(fileno(f)) == 0;
+                job->stats.bytes = ftell(f);
+                time_phase(PHASE_FSYNC);
+            }
+        }
+        catch (dbpriv_dbio_failed& exception) {
+            success = 0;
+        }
+        catch (dbpriv_dbio_shared_value& exception) {
+            success = -1;
+        }
+        dbpriv_refuse_shared_values(0);
+        if (fclose(f) != 0 && success > 0)
+            success = 0;
+        if (success <= 0)
+            remove(job->temp_name);
+    }
+    dbpriv_release_dbio_buffers();
+    measure_memory(&job->stats);
+    recording = nullptr;
 
+    job->success = success;
+    job->done = true;
+}
+
+/* Takes a snapshot for a checkpoint to `temp_name', a delta against the
+ * full dump with epoch `since' unless that's 0, and starts a thread
+ * writing it.  Returns 1 if it's under way, 0 on failure or -1 if the
+ * checkpoint has to be made by forking.
+ */
 static int
-write_db_file(const char *reason)
+start_checkpointer(const char *temp_name, enum dbio_format format,
+                   unsigned int since, unsigned int epoch, Num journaled)
 {
-    Objid oid;
-    Objid last_oid = db_last_used_objid(), max_oid = -1;
-    int nprogs = 0;
-    Verbdef *v;
+    const char *reason = reason_names[DUMP_CHECKPOINT];
+    Objid oid, last_oid = db_last_used_objid();
+    checkpoint_job *job;
     Var user_list;
-    int i;
-    volatile int success = 1;
+    struct stat st;
+    char *prefix = nullptr;
+    size_t prefix_size = 0;
+    FILE *mem;
+    int i, success = 1;
+
+    if (since && stat(dump_db_name, &st) < 0)
+        since = 0;
+
+    if (!(mem = open_memstream(&prefix, &prefix_size))) {
+        log_perror("Taking a checkpoint snapshot");
+        return 0;
+    }
 
+    dbpriv_set_dbio_output(mem);
+    dbpriv_set_dbio_output_encoding(format);
+    dbpriv_refuse_shared_values(1);
     try {
-        waif_before_saving();
-        dbio_printf(header_format_string, current_db_version);
+        if (since) {
+            dbio_printf(delta_header_format_string, current_db_version);
+            dbio_printf("%" PRIdN " %" PRIdN "\n", (Num)st.st_size, (Num)st.st_mtime);
+        } else
+            dbio_printf(header_format_string, current_db_version);
 
         user_list = db_all_users();
 
@@ -1039,77 +3095,167 @@ write_db_file(const char *reason)
         for (i = 1; i <= user_list.v.list[0].v.num; i++)
             dbio_write_objid(user_list.v.list[i].v.obj);
 
-        oklog("%s: Writing values pending finalization ...\n", reason);
         write_values_pending_finalization();
-
-        oklog("%s: Writing forked and suspended tasks ...\n", reason);
+        time_phase(PHASE_FINALIZATION);
         write_task_queue();
-
-        oklog("%s: Writing list of formerly active connections ...\n", reason);
+        time_phase(PHASE_TASKS);
         write_active_connections();
+        dbpriv_flush_dbio_output();
+        time_phase(PHASE_CONNECTIONS);
+    }
+    catch (dbpriv_dbio_failed& exception) {
+        success = 0;
+    }
+    catch (dbpriv_dbio_shared_value& exception) {
+        success = -1;
+    }
+    dbpriv_refuse_shared_values(0);
+    if (fclose(mem) != 0 && success > 0)
+        success = 0;
 
-        while (last_oid > max_oid) {
-            dbio_printf("%" PRIdN "\n", last_oid - max_oid);
-
-            oklog("%s: Writing %" PRIdN " objects ...\n", reason, last_oid - max_oid);
-            for (oid = max_oid + 1; oid <= last_oid; oid++) {
-                ng_write_object(oid);
-                if ((oid + 1) % 10000 == 0 || oid == last_oid)
-                    oklog("%s: Done writing %" PRIdN " objects ...\n", reason, oid + 1);
-            }
-            max_oid = last_oid;
-            last_oid = db_last_used_objid();
+    if (success <= 0) {
+        if (success == 0)
+            log_perror("Taking a checkpoint snapshot");
+        else {
+            oklog("%s: A snapshot can't hold anonymous objects or WAIFs\n", reason);
+            shared_values_seen = 1;
         }
+        free(prefix);
+        return success;
+    }
 
-        dbio_printf("%" PRIdN "\n", 0);
+    job = new checkpoint_job;
+    job->temp_name = str_dup(temp_name);
+    job->format = format;
+    job->since = since;
+    job->epoch = epoch;
+    job->journaled = journaled;
+    job->prefix = prefix;
+    job->prefix_size = prefix_size;
+    job->last_oid = last_oid;
+    job->fingerprint = dbio_bytecode_fingerprint();
+    job->done = false;
+    job->success = 0;
+
+    for (oid = 0; oid <= last_oid; oid++)
+        if (changed_since(oid, since))
+            job->entries.push_back({oid, valid(oid) ? copy_object(dbpriv_find_object(oid)) : nullptr});
+    time_phase(PHASE_OBJECTS);
+
+    job->stats = pending_stats;
+    job->stats.delta = since != 0;
+    job->stats.pause = monotonic_seconds() - job->stats.begun;
+    recording = nullptr;
+
+    oklog("%s: Snapshot of %" PRIdN " objects taken; writing it in the background ...\n",
+          reason, (Num)job->entries.size());
+
+    checkpointer = job;
+    try {
+        job->thread = std::thread(write_checkpoint, job);
+    }
+    catch (std::system_error& exception) {
+        errlog("%s: Can't start a thread: %s\n", reason, exception.what());
+        job->done = true;
+    }
 
-        for (oid = 0; oid <= max_oid; oid++) {
-            if (valid(oid))
-                for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next)
-                    if (v->program)
-                        nprogs++;
-        }
-
-        dbio_printf("%" PRIdN "\n", nprogs);
-
-        oklog("%s: Writing %" PRIdN " MOO verb programs ...\n", reason, nprogs);
-        for (i = 0, oid = 0; oid <= max_oid; oid++) {
-            if (valid(oid)) {
-                int vcount = 0;
-                for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next) {
-                    if (v->program) {
-                        dbio_printf("#%" PRIdN ":%" PRIdN "\n", oid, vcount);
-                        dbio_write_program(v->program);
-                        if (++i % 5000 == 0 || i == nprogs)
-                            oklog("%s: Done writing %" PRIdN " verb programs ...\n",
-                                  reason, i);
-                    }
-                    vcount++;
-                }
-            }
-        }
-        waif_after_saving();
+    return 1;
+}
+
+/* Returns 0 if no checkpoint is being written, or if it isn't done and
+ * `wait' is false.  Otherwise, finishes it off and returns 2 if it
+ * succeeded, 1 if it failed or -1 if it has to be made by forking.
+ */
+static int
+finish_checkpointer(int wait)
+{
+    const char *reason = reason_names[DUMP_CHECKPOINT];
+    checkpoint_job *job = checkpointer;
+    int result;
+
+    if (!job || (!wait && !job->done)
+            || job->thread.get_id() == std::this_thread::get_id())
+        return 0;
+
+    if (job->thread.joinable())
+        job->thread.join();
+    checkpointer = nullptr;
+
+    if (job->success > 0) {
+        oklog("%s on %s finished\n", reason, job->temp_name);
+        record_stats(&job->stats);
+        result = install_dump(DUMP_CHECKPOINT, job->temp_name, job->since != 0,
+                              job->epoch, job->journaled) ? 2 : 1;
+    } else if (job->success == 0) {
+        errlog("%s: Writing %s failed\n", reason, job->temp_name);
+        errlog("Abandoning checkpoint attempt ...\n");
+        result = 1;
+    } else {
+        oklog("%s: A snapshot can't hold anonymous objects or WAIFs\n", reason);
+        shared_values_seen = 1;
+        result = -1;
     }
-    catch (dbpriv_dbio_failed& exception) {
-        success = 0;
+    if (result > 0) {
+        end_stats(&job->stats, result == 2);
+        last_stats = job->stats;
     }
 
-    return success;
+    for (const snapshot_entry& e : job->entries)
+        if (e.o)
+            free_object_copy(e.o);
+    free(job->prefix);
+    free_str(job->temp_name);
+    delete job;
+
+    return result;
 }
 
-typedef enum {
-    DUMP_SHUTDOWN, DUMP_CHECKPOINT, DUMP_PANIC
-} Dump_Reason;
-const char *reason_names[] =
-{"DUMPING", "CHECKPOINTING", "PANIC-DUMPING"};
+#endif /* THREADED_CHECKPOINTS */
 
 static int
 dump_database(Dump_Reason reason)
 {
-    Stream *s = new_stream(100);
+    Stream *s;
     char *temp_name;
     FILE *f;
     int success;
+    int delta = 0;
+    enum dbio_format format = dump_format();
+    unsigned int epoch = 0;
+    Num journaled = 0;
+
+#ifdef THREADED_CHECKPOINTS
+    if (reason == DUMP_CHECKPOINT && checkpointer) {
+        errlog("%s: The last checkpoint is still being written; skipping this one\n",
+               reason_names[reason]);
+        return 0;
+    }
+    /* don't leave it behind, or write alongside it */
+    finish_checkpointer(1);
+#endif
+#ifndef UNFORKED_CHECKPOINTS
+    if (reason == DUMP_CHECKPOINT && forked_checkpointer_running()) {
+        errlog("%s: The last checkpoint is still being written; skipping this one\n",
+               reason_names[reason]);
+        return 0;
+    }
+    if (reason == DUMP_SHUTDOWN)
+        wait_for_forked_checkpointer();
+#endif
+
+    s = new_stream(100);
+
+#ifdef INCREMENTAL_CHECKPOINTS
+    epoch = dbpriv_next_epoch();
+    unsigned int base = reason == DUMP_CHECKPOINT ? base_epoch() : 0;
+    delta = want_delta_checkpoint(base);
+#endif
+#ifdef WRITE_AHEAD_JOURNAL
+    /* Changes from here on go to a new segment, which this dump doesn't
+     * make obsolete.
+     */
+    journaled = reason == DUMP_PANIC ? 0 : rotate_journal(reason == DUMP_CHECKPOINT);
+#endif
 
 retryDumping:
 
@@ -1124,16 +3270,59 @@ retryDumping:
     }
     temp_name = reset_stream(s);
 
-    oklog("%s on %s ...\n", reason_names[reason], temp_name);
+    oklog("%s%s on %s (%s) ...\n", reason_names[reason], delta ? " (delta)" : "", temp_name,
+          dump_format_names[format]);
+
+#ifdef THREADED_CHECKPOINTS
+    if (reason == DUMP_CHECKPOINT && !shared_values_seen) {
+#ifdef INCREMENTAL_CHECKPOINTS
+        unsigned int since = delta ? base : 0;
+#else
+        unsigned int since = 0;
+#endif
+
+        begin_stats(METHOD_THREADED, format, since != 0);
+        switch (start_checkpointer(temp_name, format, since, epoch, journaled)) {
+            case 1:
+                reset_command_history();
+                free_stream(s);
+                return 1;
+            case 0:
+                free_stream(s);
+                return 0;
+            default:
+                oklog("%s: Forking a checkpointer instead ...\n", reason_names[reason]);
+                break;
+        }
+    }
+#endif
 
 #ifdef UNFORKED_CHECKPOINTS
     reset_command_history();
+    if (reason == DUMP_CHECKPOINT)
+        begin_stats(METHOD_UNFORKED, format, delta);
 #else
     if (reason == DUMP_CHECKPOINT) {
-        switch (fork_server("checkpointer")) {
+        enum Fork_Result result;
+        int fds[2];
+
+        /* without it there'd be no telling when the checkpointer is done */
+        if (pipe(fds) < 0) {
+            log_perror("Creating checkpoint pipe");
+            free_stream(s);
+            return 0;
+        }
+
+        begin_stats(METHOD_FORKED, format, delta);
+        result = fork_server("checkpointer");
+        fork_stats(result, fds);
+        switch (result) {
             case FORK_PARENT:
                 reset_command_history();
                 free_stream(s);
+#ifdef INCREMENTAL_CHECKPOINTS
+                deltas_since_full = delta ? deltas_since_full + 1 : 0;
+#endif
                 return 1;
             case FORK_ERROR:
                 free_stream(s);
@@ -1147,10 +3336,32 @@ retryDumping:
 
     success = 1;
     if ((f = fopen(temp_name, "w")) != nullptr) {
+        int written = -1;
+
         dbpriv_set_dbio_output(f);
-        if (!write_db_file(reason_names[reason])) {
+        if (!dbpriv_set_dbio_output_format(format))
+            written = 0;
+#ifdef INCREMENTAL_CHECKPOINTS
+        if (written && delta && (written = write_delta_file(reason_names[reason], base)) < 0) {
+            oklog("%s: Writing a full checkpoint instead ...\n", reason_names[reason]);
+            delta = 0;
+            pending_stats.delta = 0;
+            memset(pending_stats.phases, 0, sizeof(pending_stats.phases));
+            if (!(f = freopen(temp_name, "w", f)))
+                written = 0;
+            else {
+                dbpriv_set_dbio_output(f);
+                if (!dbpriv_set_dbio_output_format(format))
+                    written = 0;
+            }
+        }
+#endif
+        if (written < 0)
+            written = write_db_file(reason_names[reason]);
+        if (!written) {
             log_perror("Trying to dump database");
-            fclose(f);
+            if (f)
+                fclose(f);
             remove(temp_name);
             if (reason == DUMP_CHECKPOINT) {
                 errlog("Abandoning checkpoint attempt ...\n");
@@ -1166,15 +3377,12 @@ retryDumping:
         } else {
             fflush(f);
             fsync(fileno(f));
+            if (recording)
+                recording->bytes = ftell(f);
+            time_phase(PHASE_FSYNC);
             fclose(f);
             oklog("%s on %s finished\n", reason_names[reason], temp_name);
-            if (reason != DUMP_PANIC) {
-                remove(dump_db_name);
-                if (rename(temp_name, dump_db_name) != 0) {
-                    log_perror("Renaming temporary dump file");
-                    success = 0;
-                }
-            }
+            success = install_dump(reason, temp_name, delta, epoch, journaled);
         }
     } else {
         log_perror("Opening temporary dump file");
@@ -1183,15 +3391,24 @@ retryDumping:
 
     free_stream(s);
 
-#ifndef UNFORKED_CHECKPOINTS
-    if (reason == DUMP_CHECKPOINT)
+    if (reason == DUMP_CHECKPOINT) {
+        measure_memory(&pending_stats);
+        end_stats(&pending_stats, success);
+#ifdef UNFORKED_CHECKPOINTS
+        last_stats = pending_stats;
+#else
+        if (stats_pipe >= 0
+                && write(stats_pipe, &pending_stats, sizeof(pending_stats)) < 0)
+            log_perror("Reporting checkpoint statistics");
+
         /* We're a child, so we'd better go away. */
         exit(!success);
 #endif
+    }
 
     return success;
 }
-
+
 
 /*********** External interface ***********/
 
@@ -1224,6 +3441,10 @@ db_initialize(int *pargc, char ***pargv)
     input_db = f;
     dbpriv_build_prep_table();
 
+#ifdef INCREMENTAL_CHECKPOINTS
+    run_id = (long)time(nullptr) ^ ((long)getpid() << 16);
+#endif
+
     return 1;
 }
 
@@ -1239,11 +3460,60 @@ db_load(void)
         errlog("DB_LOAD: Cannot load database!\n");
         return 0;
     }
+
+    struct stat st, loaded;
+    const char *db_names[2] = {input_db_name, dump_db_name};
+    int i, applied = -1;
+
+    fstat(fileno(input_db), &st);
+    loaded = st;
+    for (i = 0; i < 2 && applied < 0; i++) {
+        if (i > 0 && strcmp(db_names[i], db_names[0]) == 0)
+            break;
+
+        char *delta_name = delta_db_name(db_names[i]);
+        FILE *delta;
+
+        if ((delta = fopen(delta_name, "r")) != nullptr) {
+            oklog("LOADING: %s\n", delta_name);
+            dbpriv_set_dbio_input(delta);
+            if (!(applied = read_delta_file(&st))) {
+                errlog("DB_LOAD: Cannot apply checkpoint delta %s!  Move it aside to load %s without it.\n",
+                       delta_name, input_db_name);
+                fclose(delta);
+                free_str(delta_name);
+                return 0;
+            }
+            fstat(fileno(delta), &loaded);
+            fclose(delta);
+        }
+        free_str(delta_name);
+    }
+
+#ifdef WRITE_AHEAD_JOURNAL
+    {
+        std::vector<Num> segments = journal_segments(dump_db_name);
+        Num first;
+
+        if (!replay_journal(&loaded, &first)) {
+            errlog("DB_LOAD: Cannot replay the journal of %s!  Move it aside to load the last checkpoint.\n",
+                   dump_db_name);
+            return 0;
+        }
+        if (!segments.empty())
+            journal_segment = segments.back();
+        open_journal_segment();
+
+        /* until the first checkpoint, it all follows what was loaded */
+        write_journal_bases({make_journal_base(&loaded, first ? first : journal_segment)});
+    }
+#endif
     oklog("LOADING: %s done, will dump new database on %s\n",
           input_db_name, dump_db_name);
 
     str_intern_close();
 
+    dbpriv_set_dbio_input(nullptr);
     fclose(input_db);
     return 1;
 }
@@ -1256,6 +3526,12 @@ db_flush(enum db_flush_type type)
     switch (type) {
         case FLUSH_IF_FULL:
         case FLUSH_ONE_SECOND:
+#ifdef WRITE_AHEAD_JOURNAL
+            if (journal && time(nullptr) != last_commit
+                    && time(nullptr) - last_commit >= server_int_option("journal_commit_interval",
+                                                                        DEFAULT_JOURNAL_COMMIT_INTERVAL))
+                commit_journal();
+#endif
             success = 1;
             break;
 
@@ -1264,6 +3540,9 @@ db_flush(enum db_flush_type type)
             break;
 
         case FLUSH_PANIC:
+#ifdef WRITE_AHEAD_JOURNAL
+            commit_journal();
+#endif
             success = dump_database(DUMP_PANIC);
             break;
     }
@@ -1271,16 +3550,84 @@ db_flush(enum db_flush_type type)
     return success;
 }
 
+Var
+db_checkpoint_stats(void)
+{
+    Var r = new_map(), phases = new_map();
+    int i;
+
+    collect_forked_stats();
+    if (!last_stats.started) {
+        free_var(phases);
+        return r;
+    }
+
+    for (i = 0; i < N_PHASES; i++)
+        phases = mapinsert(phases, str_dup_to_var(phase_names[i]),
+                           Var::new_float(last_stats.phases[i]));
+
+    r = mapinsert(r, str_dup_to_var("started"), Var::new_int(last_stats.started));
+    r = mapinsert(r, str_dup_to_var("method"), str_dup_to_var(method_names[last_stats.method]));
+    r = mapinsert(r, str_dup_to_var("format"), str_dup_to_var(dump_format_names[last_stats.format]));
+    r = mapinsert(r, str_dup_to_var("delta"), Var::new_int(last_stats.delta));
+    r = mapinsert(r, str_dup_to_var("success"), Var::new_int(last_stats.success));
+    r = mapinsert(r, str_dup_to_var("elapsed"), Var::new_float(last_stats.elapsed));
+    r = mapinsert(r, str_dup_to_var("pause"), Var::new_float(last_stats.pause));
+    r = mapinsert(r, str_dup_to_var("phases"), phases);
+    r = mapinsert(r, str_dup_to_var("bytes"), Var::new_int(last_stats.bytes));
+    r = mapinsert(r, str_dup_to_var("rss"), Var::new_int(last_stats.rss));
+    r = mapinsert(r, str_dup_to_var("cow_pages"), Var::new_int(last_stats.cow_pages));
+
+    return r;
+}
+
+int
+db_checkpoint_finished(void)
+{
+#ifdef THREADED_CHECKPOINTS
+    int result = finish_checkpointer(0);
+
+    if (result < 0)             /* a forked checkpointer reports for itself */
+        result = dump_database(DUMP_CHECKPOINT) ? 0 : 1;
+    return result;
+#else
+    return 0;
+#endif
+}
+
 Num
 db_disk_size(void)
 {
-    struct stat st;
+    struct stat st, dst;
+    const char *name = dump_db_name;
+    char *delta_name;
+    Num size;
+
+    if ((dump_generation == 0 || stat(dump_db_name, &st) < 0)) {
+        if (stat(input_db_name, &st) < 0)
+            return -1;
+        name = input_db_name;
+    }
 
-    if ((dump_generation == 0 || stat(dump_db_name, &st) < 0)
-            && stat(input_db_name, &st) < 0)
-        return -1;
-    else
-        return st.st_size;
+    /* a checkpoint delta is part of the representation */
+    size = st.st_size;
+    delta_name = delta_db_name(name);
+    if (stat(delta_name, &dst) == 0)
+        size += dst.st_size;
+    free_str(delta_name);
+
+    return size;
+}
+
+int
+db_set_dump_format(const char *name)
+{
+    int format = find_dump_format(name);
+
+    if (format < 0)
+        return 0;
+    forced_dump_format = format;
+    return 1;
 }
 
 void
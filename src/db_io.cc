@@ -25,14 +25,25 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <charconv>
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
 
+#include "code_gen.h"
 #include "db.h"
 #include "db_io.h"
 #include "db_private.h"
+#include "functions.h"
 #include "list.h"
 #include "log.h"
 #include "map.h"
 #include "numbers.h"
+#include "opcode.h"
 #include "parser.h"
 #include "server.h"
 #include "storage.h"
@@ -44,20 +55,466 @@
 #include "waif.h"
 
 
+/*********** Binary encoding ***********/
+
+/* A binary database holds exactly what the text format would, as a
+ * stream of tokens rather than lines: dbio_write_num() and friends each
+ * write one token, and whatever dbio_printf() writes goes in as a TEXT
+ * token.  Reading it back as text, token by token, gives the text
+ * format byte for byte.  The stream follows one of these lines, and in
+ * a compressed database it is deflated with zlib.
+ */
+
+static const char binary_magic[] =
+    "** LambdaMOO Binary Database, Encoding 1 **\n";
+static const char compressed_magic[] =
+    "** LambdaMOO Compressed Database, Encoding 1 **\n";
+
+enum {
+    /* 0 .. TOKEN_NUM - 1 stand for themselves */
+    TOKEN_NUM = 0x80,		/* zigzag varint */
+    TOKEN_FLOAT,		/* IEEE double, little-endian */
+    TOKEN_STR,			/* varint length, bytes */
+    TOKEN_TEXT			/* varint length, bytes */
+};
+
+
 /*********** Input ***********/
 
+/* Where possible, the input file is mapped into memory and numbers,
+ * strings and programs are scanned straight out of the mapping.  The
+ * rarer dbio_scanf() calls go through a FILE opened over the mapping,
+ * positioned wherever the scanners have got to.  Input that can't be
+ * mapped (a pipe, say) is read through stdio as before.
+ *
+ * Several threads can read a mapping at once, each between marks of its
+ * own (see dbpriv_set_dbio_input_range()), so the read position and the
+ * buffers that go with it are per thread.  The FILE over the mapping is
+ * not; only the loading thread uses dbio_scanf() on text input.
+ */
+
 static FILE *input;
+static const char *map_base = nullptr;
+static thread_local const char *in_pos, *in_end;
+static size_t map_size;
+static FILE *map_file = nullptr;
+static char map_file_buffer[256];
+
+static void
+unmap_input(void)
+{
+    if (map_file) {
+        fclose(map_file);
+        map_file = nullptr;
+    }
+    if (map_base) {
+        munmap((void *) map_base, map_size);
+        map_base = nullptr;
+    }
+}
+
+static void
+map_input(FILE *f)
+{
+    struct stat st;
+    long offset = ftell(f);
+    void *base;
+
+    if (offset < 0 || fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode)
+            || st.st_size <= offset)
+        return;
+
+    base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (base == MAP_FAILED)
+        return;
+    posix_madvise(base, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    if (!(map_file = fmemopen(base, st.st_size, "r"))) {
+        munmap(base, st.st_size);
+        return;
+    }
+    setvbuf(map_file, map_file_buffer, _IOFBF, sizeof(map_file_buffer));
+
+    map_base = (const char *) base;
+    map_size = st.st_size;
+    in_pos = map_base + offset;
+    in_end = map_base + map_size;
+}
+
+/* A binary database (which has to be mapped) is read a token at a time.
+ * Whenever text is wanted instead, as by dbio_scanf(), tokens are
+ * rendered into `pending' as the text format would have them, and
+ * reading continues from there until it is used up.
+ */
+
+static int binary_input = 0;
+static thread_local char *pending = nullptr;
+static thread_local size_t pending_pos = 0, pending_len = 0, pending_size = 0;
+
+#ifdef ZLIB_FOUND
+static int compressed_input = 0, inflated_all;
+static z_stream inflater;
+static const char *deflated_pos;	/* not yet given to zlib */
+static char *window = nullptr;	/* in_pos and in_end point into this */
+static size_t window_size = 0;
+#endif
+
+static void
+end_binary_input(void)
+{
+#ifdef ZLIB_FOUND
+    if (compressed_input) {
+        inflateEnd(&inflater);
+        myfree(window, M_STREAM);
+        window = nullptr;
+        window_size = 0;
+        compressed_input = 0;
+    }
+#endif
+    binary_input = 0;
+    pending_pos = pending_len = 0;
+}
+
+static void
+begin_binary_input(void)
+{
+    size_t length = in_end - in_pos;
+
+    if (length >= sizeof(binary_magic) - 1
+            && memcmp(in_pos, binary_magic, sizeof(binary_magic) - 1) == 0) {
+        in_pos += sizeof(binary_magic) - 1;
+        binary_input = 1;
+    } else if (length >= sizeof(compressed_magic) - 1
+               && memcmp(in_pos, compressed_magic, sizeof(compressed_magic) - 1) == 0) {
+        binary_input = 1;
+#ifdef ZLIB_FOUND
+        memset(&inflater, 0, sizeof(inflater));
+        if (inflateInit(&inflater) == Z_OK) {
+            compressed_input = 1;
+            inflated_all = 0;
+            deflated_pos = in_pos + sizeof(compressed_magic) - 1;
+            window_size = 1 << 20;
+            window = (char *) mymalloc(window_size, M_STREAM);
+            in_pos = in_end = window;
+            return;
+        }
+#endif
+        errlog("DBIO: Can't read a compressed database without zlib\n");
+        in_pos = in_end;
+    }
+}
+
+/* Makes more input available at `in_pos', returning false if there is
+ * no more.
+ */
+static int
+refill_input(void)
+{
+#ifdef ZLIB_FOUND
+    size_t left = in_end - in_pos, produced = 0;
+    int status = Z_OK;
+
+    if (!compressed_input || inflated_all)
+        return 0;
+
+    if (left + (1 << 16) > window_size) {
+        size_t size = window_size * 2;
+        char *w;
+
+        while (size < left + (1 << 16))
+            size *= 2;
+        w = (char *) mymalloc(size, M_STREAM);
+        memcpy(w, in_pos, left);
+        myfree(window, M_STREAM);
+        window = w;
+        window_size = size;
+    } else
+        memmove(window, in_pos, left);
+    in_pos = window;
+
+    while (produced == 0 && status == Z_OK) {
+        if (inflater.avail_in == 0) {
+            size_t n = map_base + map_size - deflated_pos;
+
+            if (n > (1u << 30))
+                n = 1u << 30;
+            inflater.next_in = (Bytef *) deflated_pos;
+            inflater.avail_in = n;
+            deflated_pos += n;
+        }
+        inflater.next_out = (Bytef *) window + left;
+        inflater.avail_out = window_size - left;
+        status = inflate(&inflater, Z_NO_FLUSH);
+        produced = window_size - left - inflater.avail_out;
+    }
+    if (status == Z_STREAM_END)
+        inflated_all = 1;
+    else if (status != Z_OK && produced == 0)
+        errlog("DBIO: Compressed database is %s\n",
+               status == Z_BUF_ERROR ? "truncated" : "corrupt");
+    in_end = window + left + produced;
+
+    return produced > 0;
+#else
+    return 0;
+#endif
+}
+
+static inline int
+need_input(size_t n)
+{
+    while ((size_t) (in_end - in_pos) < n)
+        if (!refill_input())
+            return 0;
+    return 1;
+}
+
+static int
+read_varint(uint64_t * v)
+{
+    unsigned shift;
+
+    *v = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if (!need_input(1))
+            return 0;
+
+        unsigned char b = *in_pos++;
+
+        *v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+static Num
+read_token_num(unsigned char tag)
+{
+    uint64_t u;
+
+    if (tag < TOKEN_NUM)
+        return tag;
+    if (!read_varint(&u)) {
+        errlog("DBIO: Truncated number at file pos. %ld\n", dbpriv_dbio_input_offset());
+        return 0;
+    }
+    return (Num) ((u >> 1) ^ -(u & 1));
+}
+
+static double
+read_token_float(void)
+{
+    uint64_t bits = 0;
+    double d;
+    int i;
+
+    if (!need_input(8)) {
+        errlog("DBIO: Truncated float at file pos. %ld\n", dbpriv_dbio_input_offset());
+        return 0.0;
+    }
+    for (i = 7; i >= 0; i--)
+        bits = bits << 8 | (unsigned char) in_pos[i];
+    in_pos += 8;
+    memcpy(&d, &bits, sizeof(d));
+
+    return d;
+}
+
+static void
+append_pending(const char *s, size_t n)
+{
+    if (pending_pos == pending_len)
+        pending_pos = pending_len = 0;
+    if (pending_len + n > pending_size && pending_pos > 0) {
+        memmove(pending, pending + pending_pos, pending_len - pending_pos);
+        pending_len -= pending_pos;
+        pending_pos = 0;
+    }
+    if (pending_len + n > pending_size) {
+        size_t size = pending_size ? pending_size : 1024;
+        char *p;
+
+        while (size < pending_len + n)
+            size *= 2;
+        p = (char *) mymalloc(size, M_STREAM);
+        memcpy(p, pending, pending_len);
+        if (pending)
+            myfree(pending, M_STREAM);
+        pending = p;
+        pending_size = size;
+    }
+    memcpy(pending + pending_len, s, n);
+    pending_len += n;
+}
+
+/* Renders the next token onto the end of `pending', returning false if
+ * there are no more.
+ */
+static int
+render_token(void)
+{
+    char buffer[48], *p;
+    unsigned char tag;
+    uint64_t len;
+
+    if (!need_input(1))
+        return 0;
+
+    switch (tag = *in_pos++) {
+        case TOKEN_FLOAT:
+            p = buffer + snprintf(buffer, sizeof(buffer), "%.*g\n",
+                                  DBL_DIG + 4, read_token_float());
+            break;
+        case TOKEN_STR:
+        case TOKEN_TEXT:
+            if (!read_varint(&len) || !need_input(len)) {
+                errlog("DBIO: Truncated string at file pos. %ld\n",
+                       dbpriv_dbio_input_offset());
+                return 0;
+            }
+            append_pending(in_pos, len);
+            in_pos += len;
+            if (tag == TOKEN_TEXT)
+                return 1;
+            p = buffer;
+            *p++ = '\n';
+            break;
+        default:
+            if (tag > TOKEN_NUM) {
+                errlog("DBIO: Unknown token (%d) at file pos. %ld\n",
+                       (int) tag, dbpriv_dbio_input_offset());
+                return 0;
+            }
+            p = std::to_chars(buffer, buffer + sizeof(buffer) - 1,
+                              read_token_num(tag)).ptr;
+            *p++ = '\n';
+            break;
+    }
+    append_pending(buffer, p - buffer);
+
+    return 1;
+}
+
+static int
+pending_getc(void)
+{
+    while (pending_pos == pending_len)
+        if (!render_token())
+            return EOF;
+    return (unsigned char) pending[pending_pos++];
+}
+
+static int
+scan_pending(const char *format, va_list args)
+{
+    for (;;) {
+        va_list copy;
+        FILE *f;
+        int count, more;
+        long used;
+
+        if (pending_pos == pending_len && !render_token())
+            return EOF;
+        if (!(f = fmemopen(pending + pending_pos, pending_len - pending_pos, "r")))
+            return EOF;
+        va_copy(copy, args);
+        count = vfscanf(f, format, copy);
+        va_end(copy);
+        more = feof(f);
+        used = ftell(f);
+        fclose(f);
+
+        /* If it ran out of text, it may have wanted more; let it see
+         * the next token as well.
+         */
+        if (!more || !render_token()) {
+            pending_pos += used;
+            return count;
+        }
+    }
+}
 
 void
 dbpriv_set_dbio_input(FILE * f)
 {
+    end_binary_input();
+    unmap_input();
     input = f;
+    if (f)
+        map_input(f);
+    if (map_base)
+        begin_binary_input();
+}
+
+long
+dbpriv_dbio_input_offset(void)
+{
+#ifdef ZLIB_FOUND
+    if (compressed_input)
+        return inflater.total_out - (in_end - in_pos);
+#endif
+    return map_base ? in_pos - map_base : ftell(input);
+}
+
+long
+dbpriv_dbio_input_mark(void)
+{
+#ifdef ZLIB_FOUND
+    if (compressed_input)
+        return -1;
+#endif
+    if (!map_base || pending_pos != pending_len)
+        return -1;
+    return in_pos - map_base;
+}
+
+void
+dbpriv_set_dbio_input_range(long start, long end)
+{
+    in_pos = map_base + start;
+    in_end = end < 0 ? map_base + map_size : map_base + end;
+    pending_pos = pending_len = 0;
+}
+
+static inline int
+input_getc(void)
+{
+    if (binary_input)
+        return pending_getc();
+    if (!map_base)
+        return fgetc(input);
+    return in_pos < in_end ? (unsigned char) *in_pos++ : EOF;
 }
 
 void
 dbio_read_line(char *s, int n)
 {
-    fgets(s, n, input);
+    if (binary_input) {
+        int i = 0, c;
+
+        while (i < n - 1 && (c = pending_getc()) != EOF)
+            if ((s[i++] = c) == '\n')
+                break;
+        s[i] = '\0';
+        return;
+    }
+
+    if (!map_base) {
+        fgets(s, n, input);
+        return;
+    }
+
+    /* as fgets() */
+    const char *start = in_pos, *limit = in_pos + n - 1;
+    const char *nl;
+
+    if (limit > in_end)
+        limit = in_end;
+    nl = (const char *) memchr(start, '\n', limit - start);
+    in_pos = nl ? nl + 1 : limit;
+    memcpy(s, start, in_pos - start);
+    s[in_pos - start] = '\0';
 }
 
 int
@@ -67,7 +524,14 @@ dbio_scanf(const char *format, ...)
     int count;
 
     va_start(args, format);
-    count = vfscanf(input, format, args);
+    if (binary_input)
+        count = scan_pending(format, args);
+    else if (map_base) {
+        fseek(map_file, in_pos - map_base, SEEK_SET);
+        count = vfscanf(map_file, format, args);
+        in_pos = map_base + ftell(map_file);
+    } else
+        count = vfscanf(input, format, args);
     va_end(args);
 
     return count;
@@ -80,11 +544,28 @@ dbio_read_num(void)
     char *p;
     long long i;
 
-    fgets(s, sizeof(s), input);
+    if (binary_input && pending_pos == pending_len && need_input(1)
+            && (unsigned char) *in_pos <= TOKEN_NUM)
+        return read_token_num((unsigned char) *in_pos++);
+    else if (map_base && !binary_input) {
+        /* the usual case: a plain decimal number on a line of its own */
+        const char *q = in_pos, *digits;
+        int negative = q < in_end && *q == '-';
+
+        digits = q += negative;
+        for (i = 0; q < in_end && q - digits < 18 && isdigit(*q); q++)
+            i = i * 10 + (*q - '0');
+        if (q > digits && q < in_end && *q == '\n') {
+            in_pos = q + 1;
+            return negative ? -i : i;
+        }
+    }
+
+    dbio_read_line(s, sizeof(s));
     i = strtoll(s, &p, 10);
     if (isspace(*s) || *p != '\n')
         errlog("DBIO_READ_NUM: Bad number: \"%s\" at file pos. %ld\n",
-               s, ftell(input));
+               s, dbpriv_dbio_input_offset());
     return i;
 }
 
@@ -95,11 +576,17 @@ dbio_read_float(void)
     char *p;
     double d;
 
-    fgets(s, 40, input);
+    if (binary_input && pending_pos == pending_len && need_input(1)
+            && (unsigned char) *in_pos == TOKEN_FLOAT) {
+        in_pos++;
+        return read_token_float();
+    }
+
+    dbio_read_line(s, 40);
     d = strtod(s, &p);
     if (isspace(*s) || *p != '\n')
         errlog("DBIO_READ_FLOAT: Bad number: \"%s\" at file pos. %ld\n",
-               s, ftell(input));
+               s, dbpriv_dbio_input_offset());
     return d;
 }
 
@@ -109,13 +596,94 @@ dbio_read_objid(void)
     return dbio_read_num();
 }
 
+static thread_local char *copy_buffer = nullptr;
+static thread_local size_t copy_size = 0;
+static thread_local Stream *str = nullptr;
+static thread_local int intern_strings = 1;
+
+void
+dbpriv_set_dbio_interning(int intern)
+{
+    intern_strings = intern;
+}
+
+static void release_output_buffer(void);
+
+void
+dbpriv_release_dbio_buffers(void)
+{
+    if (copy_buffer) {
+        myfree(copy_buffer, M_STREAM);
+        copy_buffer = nullptr;
+        copy_size = 0;
+    }
+    if (str) {
+        free_stream(str);
+        str = nullptr;
+    }
+    if (pending) {
+        myfree(pending, M_STREAM);
+        pending = nullptr;
+        pending_pos = pending_len = pending_size = 0;
+    }
+    release_output_buffer();
+}
+
+/* Copies the next `len' bytes of input, followed by a null, to a buffer
+ * that is reused by the next call.
+ */
+static char *
+copy_input(size_t len)
+{
+    if (len >= copy_size) {
+        copy_size = len + 1 > 1024 ? len + 1 : 1024;
+        if (copy_buffer)
+            myfree(copy_buffer, M_STREAM);
+        copy_buffer = (char *) mymalloc(copy_size, M_STREAM);
+    }
+    memcpy(copy_buffer, in_pos, len);
+    copy_buffer[len] = '\0';
+    in_pos += len;
+
+    return copy_buffer;
+}
+
 const char *
 dbio_read_string(void)
 {
-    static Stream *str = nullptr;
     static char buffer[1024];
     int len, used_stream = 0;
 
+    if (binary_input) {
+        uint64_t n;
+        int c;
+
+        if (pending_pos == pending_len && need_input(1)
+                && (unsigned char) *in_pos == TOKEN_STR) {
+            in_pos++;
+            if (read_varint(&n) && need_input(n))
+                return copy_input(n);
+            errlog("DBIO_READ_STRING: Truncated string at file pos. %ld\n",
+                   dbpriv_dbio_input_offset());
+            return "";
+        }
+
+        if (str == nullptr)
+            str = new_stream(1024);
+        while ((c = pending_getc()) != EOF && c != '\n')
+            stream_add_char(str, c);
+        return reset_stream(str);
+    }
+
+    if (map_base) {
+        const char *nl = (const char *) memchr(in_pos, '\n', in_end - in_pos);
+        char *s = copy_input((nl ? nl : in_end) - in_pos);
+
+        if (nl)
+            in_pos++;
+        return s;
+    }
+
     if (str == nullptr)
         str = new_stream(1024);
 
@@ -137,13 +705,44 @@ try_again:
         return buffer;
 }
 
+int
+dbio_read_bytes(void *b, size_t n)
+{
+    uint64_t len;
+    size_t i;
+    int c;
+
+    if (binary_input && pending_pos == pending_len && need_input(1)
+            && (unsigned char) *in_pos == TOKEN_STR) {
+        in_pos++;
+        if (!read_varint(&len) || len != n || !need_input(n))
+            return 0;
+        memcpy(b, in_pos, n);
+        in_pos += n;
+        return 1;
+    } else if (map_base && !binary_input) {
+        if ((size_t) (in_end - in_pos) < n + 1 || in_pos[n] != '\n')
+            return 0;
+        memcpy(b, in_pos, n);
+        in_pos += n + 1;
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((c = input_getc()) == EOF)
+            return 0;
+        ((unsigned char *) b)[i] = c;
+    }
+    return input_getc() == '\n';
+}
+
 const char *
 dbio_read_string_intern(void)
 {
     const char *s, *r;
 
     s = dbio_read_string();
-    r = str_intern(s);
+    r = intern_strings ? str_intern(s) : str_dup(s);
 
     /* puts(r); */
 
@@ -214,15 +813,103 @@ dbio_read_var(void)
             break;
         default:
             errlog("DBIO_READ_VAR: Unknown type (%d) at DB file pos. %ld\n",
-                   l, ftell(input));
+                   l, dbpriv_dbio_input_offset());
             r = zero;
             break;
     }
     return r;
 }
 
+void
+dbpriv_skip_dbio_string(void)
+{
+    if (map_base && !binary_input) {
+        const char *nl = (const char *) memchr(in_pos, '\n', in_end - in_pos);
+
+        in_pos = nl ? nl + 1 : in_end;
+    } else
+        (void) dbio_read_string();
+}
+
+/* As read_waif() reads it. */
+static void
+skip_waif(void)
+{
+    char ref;
+    unsigned int index;
+
+    dbio_scanf("%c %u\n", &ref, &index);
+    if (ref != 'r') {
+        (void) dbio_read_objid();	/* class */
+        (void) dbio_read_objid();	/* owner */
+        (void) dbio_read_num();		/* number of propdefs */
+        while (dbio_read_num() >= 0)
+            dbpriv_skip_dbio_var();
+    }
+    (void) dbio_read_string();	/* terminator */
+}
+
+int
+dbpriv_skip_dbio_var(void)
+{
+    int i, ok = 1, l = dbio_read_num();
+
+    if (l == waif_conversion_type && waif_conversion_type != _TYPE_WAIF) {
+        skip_waif();
+        return 0;
+    }
+
+    if (l == (int) TYPE_ANY && dbio_input_version == DBV_Prehistory)
+        l = TYPE_NONE;
+
+    switch (l) {
+        case TYPE_CLEAR:
+        case TYPE_NONE:
+            break;
+        case _TYPE_STR:
+            dbpriv_skip_dbio_string();
+            break;
+        case TYPE_OBJ:
+        case TYPE_ERR:
+        case TYPE_INT:
+        case TYPE_CATCH:
+        case TYPE_FINALLY:
+        case TYPE_BOOL:
+            (void) dbio_read_num();
+            break;
+        case _TYPE_FLOAT:
+            (void) dbio_read_float();
+            break;
+        case _TYPE_MAP:
+            l = dbio_read_num();
+            for (i = 0; i < l; i++) {
+                ok &= dbpriv_skip_dbio_var();
+                ok &= dbpriv_skip_dbio_var();
+            }
+            break;
+        case _TYPE_LIST:
+            l = dbio_read_num();
+            for (i = 0; i < l; i++)
+                ok &= dbpriv_skip_dbio_var();
+            break;
+        case _TYPE_ITER:
+            return dbpriv_skip_dbio_var();
+        case _TYPE_ANON:
+            (void) dbio_read_num();
+            return 0;
+        case _TYPE_WAIF:
+            skip_waif();
+            return 0;
+        default:
+            /* left for dbio_read_var() to complain about */
+            return 0;
+    }
+    return ok;
+}
+
 struct db_state {
     char prev_char;
+    const char *text;		/* null when reading from the DB file */
     const char *(*fmtr) (void *);
     void *data;
 };
@@ -256,10 +943,13 @@ my_getc(void *data)
     struct db_state *s = (db_state *)data;
     int c;
 
-    c = fgetc(input);
+    if (s->text)
+        return *s->text ? (unsigned char) *s->text++ : EOF;
+
+    c = input_getc();
     if (c == '.' && s->prev_char == '\n') {
         /* end-of-verb marker in DB */
-        c = fgetc(input);   /* skip next newline */
+        c = input_getc();   /* skip next newline */
         return EOF;
     }
     if (c == EOF)
@@ -277,6 +967,63 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
     struct db_state s;
 
     s.prev_char = '\n';
+    s.text = nullptr;
+    s.fmtr = fmtr;
+    s.data = data;
+    return parse_program(version, parser_client, &s);
+}
+
+const char *
+dbio_read_program_text(void)
+{
+    static Stream *str = nullptr;
+    int c, prev_char = '\n';
+
+    if (map_base && !binary_input) {
+        const char *p = in_pos;
+
+        /* look for a `.' at the start of a line */
+        while (p < in_end && *p != '.') {
+            if (!(p = (const char *) memchr(p, '\n', in_end - p)))
+                break;
+            p++;
+        }
+        if (!p || p >= in_end) {
+            in_pos = in_end;
+            return nullptr;
+        }
+
+        const char *text = str_dup(copy_input(p - in_pos));
+
+        in_pos = p + 1 < in_end ? p + 2 : in_end;    /* skip `.' and newline */
+        return text;
+    }
+
+    if (str == nullptr)
+        str = new_stream(1024);
+
+    while ((c = input_getc()) != EOF) {
+        if (c == '.' && prev_char == '\n') {
+            /* end-of-verb marker in DB */
+            input_getc();   /* skip next newline */
+            return str_dup(reset_stream(str));
+        }
+        stream_add_char(str, c);
+        prev_char = c;
+    }
+
+    reset_stream(str);
+    return nullptr;
+}
+
+Program *
+dbio_parse_program_text(DB_Version version, const char *text,
+                        const char *(*fmtr) (void *), void *data)
+{
+    struct db_state s;
+
+    s.prev_char = '\n';
+    s.text = text;
     s.fmtr = fmtr;
     s.data = data;
     return parse_program(version, parser_client, &s);
@@ -285,34 +1032,305 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
 
 /*********** Output ***********/
 
-static FILE *output;
+/* Output is gathered in a large buffer of our own and handed to stdio in
+ * big chunks, which stdio passes straight to write(2), rather than going
+ * through a stdio call for every field.  Numbers are formatted with
+ * to_chars(), which gives exactly what the printf formats used to.
+ */
+
+/* Each thread has an output of its own, so that a checkpoint can be
+ * written in the background while the main thread goes on writing the
+ * journal.
+ */
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+static thread_local FILE *output;
+static thread_local char *output_buffer = nullptr;
+static thread_local size_t output_length = 0;
+static thread_local int binary_output = 0;
+
+#ifdef ZLIB_FOUND
+static thread_local int compressed_output = 0;
+static thread_local z_stream deflater;
+#endif
+
+static void
+end_binary_output(void)
+{
+#ifdef ZLIB_FOUND
+    if (compressed_output) {
+        deflateEnd(&deflater);
+        compressed_output = 0;
+    }
+#endif
+    binary_output = 0;
+}
 
 void
 dbpriv_set_dbio_output(FILE * f)
 {
+    end_binary_output();
     output = f;
+    output_length = 0;
+    if (!output_buffer)
+        output_buffer = (char *) mymalloc(OUTPUT_BUFFER_SIZE, M_STREAM);
+}
+
+static void
+release_output_buffer(void)
+{
+    if (output_buffer) {
+        myfree(output_buffer, M_STREAM);
+        output_buffer = nullptr;
+    }
+}
+
+void
+dbpriv_set_dbio_output_encoding(enum dbio_format format)
+{
+    binary_output = format != DBIO_TEXT;
+}
+
+int
+dbpriv_set_dbio_output_format(enum dbio_format format)
+{
+    const char *magic = binary_magic;
+
+    if (format == DBIO_TEXT)
+        return 1;
+
+#ifdef ZLIB_FOUND
+    if (format == DBIO_COMPRESSED) {
+        memset(&deflater, 0, sizeof(deflater));
+        if (deflateInit(&deflater, Z_BEST_SPEED) != Z_OK)
+            return 0;
+        compressed_output = 1;
+        magic = compressed_magic;
+    }
+#else
+    if (format == DBIO_COMPRESSED)
+        errlog("DBIO: No zlib; writing an uncompressed binary database\n");
+#endif
+    binary_output = 1;
+
+    return fputs(magic, output) >= 0;
+}
+
+static void
+pass_output(int finish)
+{
+#ifdef ZLIB_FOUND
+    if (compressed_output) {
+        char buffer[1 << 16];
+        int status;
+
+        deflater.next_in = (Bytef *) output_buffer;
+        deflater.avail_in = output_length;
+        do {
+            size_t n;
+
+            deflater.next_out = (Bytef *) buffer;
+            deflater.avail_out = sizeof(buffer);
+            status = deflate(&deflater, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (status == Z_STREAM_ERROR)
+                throw dbpriv_dbio_failed();
+            n = sizeof(buffer) - deflater.avail_out;
+            if (n > 0 && fwrite(buffer, 1, n, output) != n)
+                throw dbpriv_dbio_failed();
+        } while (deflater.avail_out == 0 || (finish && status != Z_STREAM_END));
+        output_length = 0;
+        if (finish)
+            end_binary_output();
+        return;
+    }
+#endif
+    if (output_length > 0
+            && fwrite(output_buffer, 1, output_length, output) != output_length)
+        throw dbpriv_dbio_failed();
+    output_length = 0;
+}
+
+void
+dbpriv_flush_dbio_output(void)
+{
+    pass_output(1);
+}
+
+/* Makes room for `n' more bytes. */
+static inline void
+reserve_output(size_t n)
+{
+    if (output_length + n > OUTPUT_BUFFER_SIZE)
+        pass_output(0);
+}
+
+static void
+write_bytes(const char *s, size_t n)
+{
+    while (n > 0) {
+        size_t chunk = OUTPUT_BUFFER_SIZE - output_length;
+
+        if (chunk == 0) {
+            pass_output(0);
+            continue;
+        }
+        if (chunk > n)
+            chunk = n;
+        memcpy(output_buffer + output_length, s, chunk);
+        output_length += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+void
+dbpriv_write_dbio_encoded(const char *s, size_t n)
+{
+    write_bytes(s, n);
+}
+
+static inline void
+write_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        output_buffer[output_length++] = (char) (v | 0x80);
+        v >>= 7;
+    }
+    output_buffer[output_length++] = (char) v;
+}
+
+/* Writes the tag and length of a STR or TEXT token; its bytes follow. */
+static void
+write_token_header(int tag, size_t length)
+{
+    reserve_output(11);
+    output_buffer[output_length++] = (char) tag;
+    write_varint(length);
+}
+
+static void
+write_text(const char *s, size_t n)
+{
+    if (binary_output)
+        write_token_header(TOKEN_TEXT, n);
+    write_bytes(s, n);
+}
+
+static thread_local int refuse_shared_values = 0;
+
+void
+dbpriv_refuse_shared_values(int refuse)
+{
+    refuse_shared_values = refuse;
 }
 
 void
 dbio_printf(const char *format, ...)
 {
     va_list args;
+    size_t room = OUTPUT_BUFFER_SIZE - output_length;
+    int n;
+
+    if (binary_output) {
+        char buffer[1024], *s = buffer;
+
+        va_start(args, format);
+        n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0)
+            throw dbpriv_dbio_failed();
+        if ((size_t) n >= sizeof(buffer)) {
+            s = (char *) mymalloc(n + 1, M_STREAM);
+            va_start(args, format);
+            vsnprintf(s, n + 1, format, args);
+            va_end(args);
+        }
+        try {
+            write_text(s, n);
+        }
+        catch (dbpriv_dbio_failed& exception) {
+            if (s != buffer)
+                myfree(s, M_STREAM);
+            throw;
+        }
+        if (s != buffer)
+            myfree(s, M_STREAM);
+        return;
+    }
 
     va_start(args, format);
-    if (vfprintf(output, format, args) < 0)
+    n = vsnprintf(output_buffer + output_length, room, format, args);
+    va_end(args);
+    if (n < 0)
         throw dbpriv_dbio_failed();
+    if ((size_t) n < room) {
+        output_length += n;
+        return;
+    }
+
+    /* didn't fit; try again in an empty buffer, or hand it to stdio */
+    pass_output(0);
+    va_start(args, format);
+    if ((size_t) n < OUTPUT_BUFFER_SIZE)
+        n = vsnprintf(output_buffer, OUTPUT_BUFFER_SIZE, format, args);
+    else
+        n = vfprintf(output, format, args);
     va_end(args);
+    if (n < 0)
+        throw dbpriv_dbio_failed();
+    if ((size_t) n < OUTPUT_BUFFER_SIZE)
+        output_length = n;
 }
 
 void
 dbio_write_num(Num n)
 {
-    dbio_printf("%" PRIdN "\n", n);
+    char *p;
+
+    if (binary_output) {
+        reserve_output(11);
+        if (n >= 0 && n < TOKEN_NUM)
+            output_buffer[output_length++] = (char) n;
+        else {
+            output_buffer[output_length++] = (char) TOKEN_NUM;
+            write_varint(((uint64_t) n << 1) ^ (uint64_t) (n < 0 ? -1 : 0));
+        }
+        return;
+    }
+
+    reserve_output(24);
+    p = std::to_chars(output_buffer + output_length,
+                      output_buffer + OUTPUT_BUFFER_SIZE, n).ptr;
+    *p++ = '\n';
+    output_length = p - output_buffer;
 }
 
 void
 dbio_write_float(double d)
 {
+    if (binary_output) {
+        uint64_t bits;
+        int i;
+
+        memcpy(&bits, &d, sizeof(bits));
+        reserve_output(9);
+        output_buffer[output_length++] = (char) TOKEN_FLOAT;
+        for (i = 0; i < 8; i++, bits >>= 8)
+            output_buffer[output_length++] = (char) (bits & 0xff);
+        return;
+    }
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    char *p;
+
+    reserve_output(48);
+    p = std::to_chars(output_buffer + output_length,
+                      output_buffer + OUTPUT_BUFFER_SIZE, d,
+                      std::chars_format::general, DBL_DIG + 4).ptr;
+    *p++ = '\n';
+    output_length = p - output_buffer;
+#else
     static const char *fmt = nullptr;
     static char buffer[10];
 
@@ -321,6 +1339,7 @@ dbio_write_float(double d)
         fmt = buffer;
     }
     dbio_printf(fmt, d);
+#endif
 }
 
 void
@@ -332,7 +1351,24 @@ dbio_write_objid(Objid oid)
 void
 dbio_write_string(const char *s)
 {
-    dbio_printf("%s\n", s ? s : "");
+    size_t n = s ? strlen(s) : 0;
+
+    if (binary_output)
+        write_token_header(TOKEN_STR, n);
+    write_bytes(s, n);
+    if (!binary_output)
+        write_bytes("\n", 1);
+}
+
+void
+dbio_write_bytes(const void *b, size_t n)
+{
+    /* as a string would be, but it may hold anything, newlines included */
+    if (binary_output)
+        write_token_header(TOKEN_STR, n);
+    write_bytes((const char *) b, n);
+    if (!binary_output)
+        write_bytes("\n", 1);
 }
 
 static int
@@ -386,9 +1422,13 @@ dbio_write_var(Var v)
                 dbio_write_var(v.v.list[i + 1]);
             break;
         case TYPE_ANON:
+            if (refuse_shared_values)
+                throw dbpriv_dbio_shared_value();
             db_write_anonymous(v);
             break;
         case TYPE_WAIF:
+            if (refuse_shared_values)
+                throw dbpriv_dbio_shared_value();
             write_waif(v);
             break;
         case TYPE_BOOL:
@@ -403,19 +1443,340 @@ dbio_write_var(Var v)
 static void
 receiver(void *data, const char *line)
 {
-    dbio_printf("%s\n", line);
+    dbio_write_string(line);
 }
 
 void
 dbio_write_program(Program * program)
 {
     unparse_program(program, receiver, nullptr, 1, 0, MAIN_VECTOR);
-    dbio_printf(".\n");
+    write_text(".\n", 2);
+}
+
+void
+dbio_write_program_text(const char *text)
+{
+    write_text(text, strlen(text));
+    write_text(".\n", 2);
+}
+
+/*********** Compiled programs ***********/
+
+static unsigned
+fingerprint_add(unsigned h, const char *s)
+{
+    /* FNV-1a */
+    while (*s)
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    return (h ^ 0xff) * 16777619u;
+}
+
+unsigned
+dbio_bytecode_fingerprint(void)
+{
+    static unsigned fingerprint = 0;
+    char buffer[100];
+    unsigned n;
+
+    if (fingerprint)
+        return fingerprint;
+
+    fingerprint = 2166136261u;
+    snprintf(buffer, sizeof(buffer), "%d %d %d %d %d %d %d %d",
+             CODE_GEN_REVISION,
+             (int) current_db_version, (int) OP_EXTENDED, (int) OPTIM_NUM_START,
+             (int) EOP_COMPLEMENT, NUM_READY_VARS, OPTIM_NUM_LOW,
+             (int) sizeof(Num));
+    fingerprint = fingerprint_add(fingerprint, buffer);
+    fingerprint = fingerprint_add(fingerprint, server_version);
+
+    /* OP_BI_FUNC_CALL refers to built-in functions by number */
+    for (n = 0; n < num_builtin_functions(); n++)
+        fingerprint = fingerprint_add(fingerprint, name_func_by_num(n));
+
+    return fingerprint;
+}
+
+static void
+write_bytecodes(Bytecodes *bc)
+{
+    dbio_write_num(bc->numbytes_label);
+    dbio_write_num(bc->numbytes_literal);
+    dbio_write_num(bc->numbytes_fork);
+    dbio_write_num(bc->numbytes_var_name);
+    dbio_write_num(bc->numbytes_stack);
+    dbio_write_num(bc->max_stack);
+    dbio_write_num(bc->size);
+    dbio_write_bytes(bc->vector, bc->size);
+}
+
+void
+dbio_write_program_bytecode(Program *p)
+{
+    unsigned i;
+
+    dbio_write_num(p->version);
+    dbio_write_num(p->first_lineno);
+    write_bytecodes(&p->main_vector);
+
+    dbio_write_num(p->num_literals);
+    for (i = 0; i < p->num_literals; i++)
+        dbio_write_var(p->literals[i]);
+
+    dbio_write_num(p->fork_vectors_size);
+    for (i = 0; i < p->fork_vectors_size; i++)
+        write_bytecodes(&p->fork_vectors[i]);
+
+    dbio_write_num(p->num_var_names);
+    for (i = 0; i < p->num_var_names; i++)
+        dbio_write_string(p->var_names[i]);
+}
+
+static int
+read_bytecodes(Bytecodes *bc)
+{
+    bc->numbytes_label = dbio_read_num();
+    bc->numbytes_literal = dbio_read_num();
+    bc->numbytes_fork = dbio_read_num();
+    bc->numbytes_var_name = dbio_read_num();
+    bc->numbytes_stack = dbio_read_num();
+    bc->max_stack = dbio_read_num();
+    bc->size = dbio_read_num();
+    bc->vector = (Byte *)mymalloc(bc->size, M_BYTECODES);
+
+    return dbio_read_bytes(bc->vector, bc->size);
+}
+
+static int
+valid_ref_size(unsigned n)
+{
+    return n == 1 || n == 2 || n == 4;
+}
+
+/* Walks one code vector the way disassemble() does and checks that every
+ * operand lies inside the vector and refers to something the program
+ * actually has.  Bytecode that passes can still be wrong, but it cannot
+ * make the interpreter index past the end of anything.
+ */
+static int
+check_bytecodes(const Program *p, const Bytecodes *bc)
+{
+    unsigned pc = 0;
+
+    if (!valid_ref_size(bc->numbytes_label)
+            || !valid_ref_size(bc->numbytes_literal)
+            || !valid_ref_size(bc->numbytes_fork)
+            || !valid_ref_size(bc->numbytes_var_name)
+            || !valid_ref_size(bc->numbytes_stack))
+        return 0;
+
+#define OPERAND(n, var)                                         \
+    do {                                                        \
+        unsigned nb_ = (n), i_;                                 \
+        if (bc->size - pc < nb_)                                \
+            return 0;                                           \
+        for (var = 0, i_ = 0; i_ < nb_; i_++)                   \
+            var = (var << 8) + bc->vector[pc++];                \
+    } while (0)
+#define CHECK(n, bound)                                         \
+    do {                                                        \
+        unsigned a_;                                            \
+        OPERAND(n, a_);                                         \
+        if (a_ >= (unsigned) (bound))                           \
+            return 0;                                           \
+    } while (0)
+#define LABEL()     CHECK(bc->numbytes_label, bc->size)
+#define VAR()       CHECK(bc->numbytes_var_name, p->num_var_names)
+#define STACK()     CHECK(bc->numbytes_stack, bc->max_stack + 1)
+
+    while (pc < bc->size) {
+        unsigned b = bc->vector[pc++];
+
+        if (IS_OPTIM_NUM_OPCODE(b))
+            continue;
+#ifdef BYTECODE_REDUCE_REF
+        if (IS_PUSH_CLEAR_n(b)) {
+            if (PUSH_CLEAR_n_INDEX(b) >= p->num_var_names)
+                return 0;
+            continue;
+        }
+#endif /* BYTECODE_REDUCE_REF */
+        if (IS_PUSH_n(b)) {
+            if (PUSH_n_INDEX(b) >= p->num_var_names)
+                return 0;
+            continue;
+        }
+        if (IS_PUT_n(b)) {
+            if (PUT_n_INDEX(b) >= p->num_var_names)
+                return 0;
+            continue;
+        }
+
+        if (b == OP_EXTENDED) {
+            OPERAND(1, b);
+            switch ((Extended_Opcode) b) {
+                case EOP_WHILE_ID:
+                case EOP_FOR_LIST_1:
+                    VAR();
+                    LABEL();
+                    break;
+                case EOP_EXIT_ID:
+                    VAR();
+                /* fall thru */
+                case EOP_EXIT:
+                    STACK();
+                    LABEL();
+                    break;
+                case EOP_PUSH_LABEL:
+                case EOP_END_CATCH:
+                case EOP_END_EXCEPT:
+                case EOP_TRY_FINALLY:
+                    LABEL();
+                    break;
+                case EOP_TRY_EXCEPT:
+                    CHECK(1, 256);
+                    break;
+                case EOP_FIRST:
+                case EOP_LAST:
+                    STACK();
+                    break;
+                case EOP_SCATTER:
+                {
+                    unsigned i, nargs;
+
+                    OPERAND(1, nargs);
+                    CHECK(1, 256);
+                    CHECK(1, 256);
+                    for (i = 0; i < nargs; i++) {
+                        VAR();
+                        LABEL();
+                    }
+                    LABEL();
+                }
+                break;
+                case EOP_FOR_LIST_2:
+                    VAR();
+                    VAR();
+                    LABEL();
+                    break;
+                default:
+                    if (b > EOP_COMPLEMENT)
+                        return 0;
+                    break;
+            }
+            continue;
+        }
+
+        switch ((Opcode) b) {
+            case OP_IF:
+            case OP_IF_QUES:
+            case OP_EIF:
+            case OP_AND:
+            case OP_OR:
+            case OP_JUMP:
+            case OP_WHILE:
+                LABEL();
+                break;
+            case OP_FORK:
+                CHECK(bc->numbytes_fork, p->fork_vectors_size);
+                break;
+            case OP_FORK_WITH_ID:
+                CHECK(bc->numbytes_fork, p->fork_vectors_size);
+                VAR();
+                break;
+            case OP_FOR_LIST:
+            case OP_FOR_RANGE:
+                VAR();
+                LABEL();
+                break;
+            case OP_G_PUSH:
+#ifdef BYTECODE_REDUCE_REF
+            case OP_G_PUSH_CLEAR:
+#endif /* BYTECODE_REDUCE_REF */
+            case OP_G_PUT:
+                VAR();
+                break;
+            case OP_IMM:
+                CHECK(bc->numbytes_literal, p->num_literals);
+                break;
+            case OP_BI_FUNC_CALL:
+                CHECK(1, num_builtin_functions());
+                break;
+            default:
+                break;
+        }
+    }
+
+#undef STACK
+#undef VAR
+#undef LABEL
+#undef CHECK
+#undef OPERAND
+
+    return 1;
+}
+
+/* Returns nullptr, having still consumed the whole record, if the bytecode
+ * is malformed or refers outside its own program; the caller then compiles
+ * the verb from its source instead.
+ */
+Program *
+dbio_read_program_bytecode(void)
+{
+    Program *p = new_program();
+    unsigned i;
+    int ok = 1;
+
+    p->version = (DB_Version) dbio_read_num();
+    p->first_lineno = p->cached_lineno = dbio_read_num();
+
+    p->literals = nullptr;
+    p->fork_vectors = nullptr;
+    p->fork_vectors_size = 0;
+    p->var_names = nullptr;
+    p->num_var_names = 0;
+
+    ok = read_bytecodes(&p->main_vector) && check_db_version(p->version);
+
+    p->num_literals = dbio_read_num();
+    if (p->num_literals)
+        p->literals = (Var *)mymalloc(p->num_literals * sizeof(Var), M_LIT_LIST);
+    for (i = 0; i < p->num_literals; i++)
+        p->literals[i] = dbio_read_var();
+
+    p->fork_vectors_size = dbio_read_num();
+    if (p->fork_vectors_size)
+        p->fork_vectors = (Bytecodes *)mymalloc(p->fork_vectors_size * sizeof(Bytecodes),
+                                                M_FORK_VECTORS);
+    for (i = 0; i < p->fork_vectors_size; i++)
+        if (!read_bytecodes(&p->fork_vectors[i]))
+            ok = 0;
+
+    p->num_var_names = dbio_read_num();
+    p->var_names = (const char **)mymalloc(p->num_var_names * sizeof(const char *), M_NAMES);
+    for (i = 0; i < p->num_var_names; i++)
+        p->var_names[i] = dbio_read_string_intern();
+
+    if (ok && !check_bytecodes(p, &p->main_vector))
+        ok = 0;
+    for (i = 0; ok && i < p->fork_vectors_size; i++)
+        if (!check_bytecodes(p, &p->fork_vectors[i]))
+            ok = 0;
+
+    if (!ok) {
+        free_program(p);
+        return nullptr;
+    }
+
+    /* as for a program compiled from source; this is the main thread */
+    intern_program_literals(p);
+
+    return p;
 }
 
 void
 dbio_write_forked_program(Program * program, int f_index)
 {
     unparse_program(program, receiver, nullptr, 1, 0, f_index);
-    dbio_printf(".\n");
+    write_text(".\n", 2);
 }
@@ -35,6 +35,8 @@
 #include "dependencies/xtrapbits.h"
 #include "map.h"
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
 #include "options.h"
 #include "log.h"
 
@@ -43,17 +45,195 @@ static Num num_objects = 0;
 static Num max_objects = 0;
 
 static unsigned int nonce = 0;
+static unsigned int checkpoint_epoch = 1;
+
+/* Numbers of the objects changed or recycled since the journal last
+ * took them, while it is keeping track (see `dbpriv_take_changes').
+ */
+static std::vector<Objid> *changed_objects = nullptr;
 
 static Var all_users;
 
 #ifdef USE_ANCESTOR_CACHE
-static std::unordered_map <int, Var> ancestor_cache;
+static void forget_ancestors(Var obj);
 #endif /* USE_ANCESTOR_CACHE */
 
 /* used in graph traversals */
 static unsigned char *bit_array;
 static size_t array_size = 0;
 
+/*********** Indexed contents and children ***********/
+
+/* Once an object's `contents' or `children' grows to OBJSET_MIN members,
+ * they are also kept in an insertion-ordered hash set, so that adding or
+ * removing one takes constant time instead of a scan (and often a copy)
+ * of the whole list.  The list in the field is then only the set's
+ * presentation: appending keeps it up to date while nothing else holds
+ * it, any other change drops it, and it is rebuilt the next time it is
+ * asked for.  So outside of this file, neither field of a permanent
+ * object may be read other than through `dbpriv_object_contents' and
+ * `dbpriv_object_children'.
+ */
+
+#define OBJSET_MIN 64
+
+struct Objset {
+    std::vector<Objid> order;   /* NOTHING where a member was removed */
+    std::unordered_map<Objid, size_t> where;    /* index into `order' */
+};
+
+static Objset *
+new_objset(Var list)
+{
+    Objset *set = new Objset;
+    int i, n = listlength(list);
+
+    set->order.reserve(n);
+    set->where.reserve(n);
+    for (i = 1; i <= n; i++) {
+        set->where[list.v.list[i].v.obj] = set->order.size();
+        set->order.push_back(list.v.list[i].v.obj);
+    }
+
+    return set;
+}
+
+static void
+free_objset(Objset **setp)
+{
+    delete *setp;
+    *setp = nullptr;
+}
+
+/* Squeezes out the holes left by removed members. */
+static void
+compact_objset(Objset *set)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < set->order.size(); i++)
+        if (set->order[i] != NOTHING) {
+            set->where[set->order[i]] = n;
+            set->order[n++] = set->order[i];
+        }
+    set->order.resize(n);
+}
+
+static void
+drop_presentation(Var *field)
+{
+    free_var(*field);
+    *field = none;
+}
+
+/* Makes sure `*field' holds the list of members.  A set that has shrunk
+ * well below OBJSET_MIN is done away with.
+ */
+static void
+present(Var *field, Objset **setp)
+{
+    Objset *set = *setp;
+    size_t i;
+
+    if (!set)
+        return;
+
+    if (field->type != TYPE_LIST) {
+        compact_objset(set);
+        *field = new_list(set->order.size());
+        for (i = 0; i < set->order.size(); i++)
+            field->v.list[i + 1] = Var::new_obj(set->order[i]);
+    }
+
+    if (set->where.size() < OBJSET_MIN / 2)
+        free_objset(setp);
+}
+
+static int
+count_members(Var field, Objset *set)
+{
+    return set ? set->where.size() : listlength(field);
+}
+
+/* Appends `oid', unless it's already a member. */
+static void
+add_member(Var *field, Objset **setp, Objid oid)
+{
+    Objset *set = *setp;
+
+    if (!set) {
+        if (listlength(*field) < OBJSET_MIN) {
+            *field = setadd(*field, Var::new_obj(oid));
+            return;
+        }
+        set = *setp = new_objset(*field);
+    }
+
+    if (!set->where.emplace(oid, set->order.size()).second)
+        return;
+    set->order.push_back(oid);
+
+    if (field->type == TYPE_LIST && var_refcount(*field) == 1)
+        *field = listappend(*field, Var::new_obj(oid));
+    else
+        drop_presentation(field);
+}
+
+static void
+remove_member(Var *field, Objset **setp, Objid oid)
+{
+    Objset *set = *setp;
+
+    if (!set) {
+        if (listlength(*field) < OBJSET_MIN) {
+            *field = setremove(*field, Var::new_obj(oid));
+            return;
+        }
+        set = *setp = new_objset(*field);
+    }
+
+    auto it = set->where.find(oid);
+
+    if (it == set->where.end())
+        return;
+    if (it->second + 1 == set->order.size())
+        set->order.pop_back();
+    else
+        set->order[it->second] = NOTHING;
+    set->where.erase(it);
+
+    if (set->order.size() > 2 * set->where.size() + OBJSET_MIN)
+        compact_objset(set);
+    drop_presentation(field);
+}
+
+/* Puts `oid' at `position', or at the end if that's out of range. */
+static void
+insert_member(Var *field, Objset **setp, Objid oid, int position)
+{
+    if (position <= 0 || position > count_members(*field, *setp)) {
+        add_member(field, setp, oid);
+        return;
+    }
+
+    /* rare enough to be done on the list itself */
+    present(field, setp);
+    free_objset(setp);
+    *field = listinsert(*field, Var::new_obj(oid), position);
+}
+
+/* Leaves both lists of `o' complete and unindexed, for code that edits
+ * them in place.
+ */
+static void
+settle(Object *o)
+{
+    present(&o->contents, &o->contents_set);
+    free_objset(&o->contents_set);
+    present(&o->children, &o->children_set);
+    free_objset(&o->children_set);
+}
+
 /*********** Objects qua objects ***********/
 
 Object *
@@ -82,7 +262,6 @@ db_reset_last_used_objid(void)
 {
     while (!objects[num_objects - 1])
         num_objects--;
-    db_clear_ancestor_cache();
 }
 
 void
@@ -138,6 +317,59 @@ void
 dbpriv_assign_nonce(Object *o)
 {
     o->nonce = nonce++;
+    /* a new layout always means the saved form is out of date */
+    dbpriv_mark_dirty(o);
+}
+
+static inline void
+note_change(Objid oid)
+{
+    if (changed_objects && oid >= 0)
+        changed_objects->push_back(oid);
+}
+
+void
+dbpriv_mark_dirty(Object *o)
+{
+    o->dirty = checkpoint_epoch;
+    note_change(o->id);
+}
+
+void
+dbpriv_track_changes(int track)
+{
+    if (track && !changed_objects)
+        changed_objects = new std::vector<Objid>;
+    else if (!track && changed_objects) {
+        delete changed_objects;
+        changed_objects = nullptr;
+    }
+}
+
+Var
+dbpriv_take_changes(void)
+{
+    Var r;
+    size_t i, n;
+
+    if (!changed_objects)
+        return new_list(0);
+
+    std::sort(changed_objects->begin(), changed_objects->end());
+    n = std::unique(changed_objects->begin(), changed_objects->end()) - changed_objects->begin();
+
+    r = new_list(n);
+    for (i = 0; i < n; i++)
+        r.v.list[i + 1] = Var::new_obj((*changed_objects)[i]);
+    changed_objects->clear();
+
+    return r;
+}
+
+unsigned int
+dbpriv_next_epoch(void)
+{
+    return checkpoint_epoch++;
 }
 
 void
@@ -172,6 +404,11 @@ dbpriv_new_object(Num new_objid)
     o = objects[new_objid] = (Object *)mymalloc(sizeof(Object), M_OBJECT);
     o->id = new_objid;
     o->waif_propdefs = nullptr;
+    o->prop_index = nullptr;
+    o->contents_set = o->children_set = nullptr;
+    o->ancestors = none;
+    o->dirty = checkpoint_epoch;
+    dbpriv_assign_verb_stamp(o);
 
     return o;
 }
@@ -184,6 +421,11 @@ dbpriv_new_anonymous_object(void)
     ensure_new_object();
     o = objects[num_objects] = (Object *)mymalloc(sizeof(Object), M_ANON);
     o->id = NOTHING;
+    dbpriv_assign_verb_stamp(o);
+    o->prop_index = nullptr;
+    o->contents_set = o->children_set = nullptr;
+    o->ancestors = none;
+    o->dirty = checkpoint_epoch;
     num_objects++;
 
     return o;
@@ -217,6 +459,11 @@ db_init_object(Object *o)
     o->propdefs.l = nullptr;
 
     o->verbdefs = nullptr;
+
+    /* A fresh layout; this also keeps a recycled allocation from
+     * matching property lookups cached against its old occupant.
+     */
+    dbpriv_assign_nonce(o);
 }
 
 Objid
@@ -233,64 +480,126 @@ db_create_object(Num new_objid)
     return o->id;
 }
 
-void
-db_destroy_object(Objid oid)
+/* Frees an object and everything it holds, without regard to where it
+ * sits in the object hierarchies.
+ */
+static void
+free_object(Object *o)
 {
-    Object *o = dbpriv_find_object(oid);
     Verbdef *v, *w;
     int i;
 
-    db_priv_affected_callable_verb_lookup();
-
-    if (!o)
-        panic_moo("DB_DESTROY_OBJECT: Invalid object!");
-
-    if (o->location.v.obj != NOTHING ||
-            o->contents.v.list[0].v.num != 0 ||
-            (o->parents.type == TYPE_OBJ && o->parents.v.obj != NOTHING) ||
-            (o->parents.type == TYPE_LIST && o->parents.v.list[0].v.num != 0) ||
-            o->children.v.list[0].v.num != 0)
-        panic_moo("DB_DESTROY_OBJECT: Not a barren orphan!");
-
     free_var(o->parents);
+    free_var(o->ancestors);
     free_var(o->children);
+    free_objset(&o->children_set);
 
     free_var(o->location);
     free_var(o->last_move);
     free_var(o->contents);
+    free_objset(&o->contents_set);
 
-    if (is_user(oid)) {
-        Var t;
-
-        t.type = TYPE_OBJ;
-        t.v.obj = oid;
-        all_users = setremove(all_users, t);
-    }
     free_str(o->name);
 
-    for (i = 0; i < o->propdefs.cur_length; i++) {
-        /* As an orphan, the only properties on this object are the ones
-         * defined on it directly, so these two arrays must be the same length.
-         */
+    for (i = 0; i < o->propdefs.cur_length; i++)
         free_str(o->propdefs.l[i].name);
-        free_var(o->propval[i].var);
-    }
     if (o->propdefs.l)
         myfree(o->propdefs.l, M_PROPDEF);
+    for (i = 0; i < o->nval; i++)
+        free_var(o->propval[i].var);
     if (o->propval)
         myfree(o->propval, M_PVAL);
     o->nval = 0;
+    dbpriv_free_prop_index(o);
 
     for (v = o->verbdefs; v; v = w) {
         if (v->program)
             free_program(v->program);
+        if (v->source)
+            free_str(v->source);
         free_str(v->name);
         w = v->next;
         myfree(v, M_VERBDEF);
     }
 
-    myfree(objects[oid], M_OBJECT);
+    myfree(o, M_OBJECT);
+}
+
+void
+db_destroy_object(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    if (!o)
+        panic_moo("DB_DESTROY_OBJECT: Invalid object!");
+
+    dbpriv_forget_cached_verbs(o);
+
+    if (o->location.v.obj != NOTHING ||
+            count_members(o->contents, o->contents_set) != 0 ||
+            (o->parents.type == TYPE_OBJ && o->parents.v.obj != NOTHING) ||
+            (o->parents.type == TYPE_LIST && o->parents.v.list[0].v.num != 0) ||
+            count_members(o->children, o->children_set) != 0)
+        panic_moo("DB_DESTROY_OBJECT: Not a barren orphan!");
+
+    if (is_user(oid)) {
+        Var t;
+
+        t.type = TYPE_OBJ;
+        t.v.obj = oid;
+        all_users = setremove(all_users, t);
+    }
+
+    free_object(o);
     objects[oid] = nullptr;
+    note_change(oid);
+}
+
+Object *
+dbpriv_replace_object(Objid oid)
+{
+    Object *o;
+
+    dbpriv_forget_object(oid);
+    if (oid >= num_objects) {
+        extend(oid + 1);
+        num_objects = oid + 1;
+    }
+
+    o = objects[oid] = (Object *)mymalloc(sizeof(Object), M_OBJECT);
+    o->id = oid;
+    o->waif_propdefs = nullptr;
+    o->prop_index = nullptr;
+    o->contents_set = o->children_set = nullptr;
+    o->ancestors = none;
+    o->dirty = checkpoint_epoch;
+    dbpriv_assign_verb_stamp(o);
+
+    return o;
+}
+
+void
+dbpriv_forget_object(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    if (o) {
+        dbpriv_forget_cached_verbs(o);
+        free_object(o);
+        objects[oid] = nullptr;
+    }
+}
+
+void
+dbpriv_set_last_used_objid(Objid oid)
+{
+    Objid i;
+
+    for (i = oid + 1; i < num_objects; i++)
+        dbpriv_forget_object(i);
+    if (oid + 1 > num_objects)
+        extend(oid + 1);
+    num_objects = oid + 1;
 }
 
 Var
@@ -350,27 +659,41 @@ db_make_anonymous(Objid oid, Objid last)
 {
     Object *o = objects[oid];
     Var old_parents = o->parents;
-    Var me = Var::new_obj(oid);
 
     Var parent;
     int i, c;
 
     /* remove me from my old parents' children */
-    if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING)
-        objects[old_parents.v.obj]->children = setremove(objects[old_parents.v.obj]->children, me);
+    if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING) {
+        remove_member(&objects[old_parents.v.obj]->children,
+                      &objects[old_parents.v.obj]->children_set, oid);
+        dbpriv_mark_dirty(objects[old_parents.v.obj]);
+    }
     else if (old_parents.type == TYPE_LIST)
-        FOR_EACH(parent, old_parents, i, c)
-        objects[parent.v.obj]->children = setremove(objects[parent.v.obj]->children, me);
+        FOR_EACH(parent, old_parents, i, c) {
+            remove_member(&objects[parent.v.obj]->children,
+                          &objects[parent.v.obj]->children_set, oid);
+            dbpriv_mark_dirty(objects[parent.v.obj]);
+        }
 
     objects[oid] = nullptr;
+    note_change(oid);
     db_set_last_used_objid(last);
 
+    /* `o' is about to move; forget any lookups cached against it. */
+    dbpriv_forget_cached_verbs(o);
+    dbpriv_free_prop_index(o);
+
     o->id = NOTHING;
 
+    free_var(o->ancestors);
+    o->ancestors = none;
     free_var(o->children);
+    free_objset(&o->children_set);
     free_var(o->location);
     free_var(o->last_move);
     free_var(o->contents);
+    free_objset(&o->contents_set);
 
     /* Last step, reallocate the memory and copy -- anonymous objects
      * require space for reference counting.
@@ -403,10 +726,13 @@ db_destroy_anonymous_object(void *obj)
     if (o->propval)
         myfree(o->propval, M_PVAL);
     o->nval = 0;
+    dbpriv_free_prop_index(o);
 
     for (v = o->verbdefs; v; v = w) {
         if (v->program)
             free_program(v->program);
+        if (v->source)
+            free_str(v->source);
         free_str(v->name);
         w = v->next;
         myfree(v, M_VERBDEF);
@@ -468,16 +794,15 @@ db_renumber_object(Objid old)
     Objid _new;
     Object *o;
 
-#ifdef USE_ANCESTOR_CACHE
-    db_clear_ancestor_cache();
-#endif /* USE_ANCESTOR_CACHE */
-
     for (_new = 0; _new < old; _new++) {
         if (objects[_new] == nullptr) {
             /* Change the identity of the object. */
             o = objects[_new] = objects[old];
             objects[old] = nullptr;
             objects[_new]->id = _new;
+            note_change(old);
+            dbpriv_mark_verbs_edited(o);
+            dbpriv_mark_dirty(o);
 
             /* Fix up the parents/children hierarchy and the
              * location/contents hierarchy.
@@ -485,6 +810,16 @@ db_renumber_object(Objid old)
             int i1, c1, i2, c2;
             Var obj1, obj2;
 
+            settle(o);
+            if (TYPE_LIST == o->parents.type) {
+                FOR_EACH(obj1, o->parents, i1, c1)
+                settle(objects[obj1.v.obj]);
+            }
+            else if (NOTHING != o->parents.v.obj)
+                settle(objects[o->parents.v.obj]);
+            if (NOTHING != o->location.v.obj)
+                settle(objects[o->location.v.obj]);
+
 #define     FIX(up, down)                           \
     if (TYPE_LIST == o->up.type) {                  \
         FOR_EACH(obj1, o->up, i1, c1) {                 \
@@ -492,6 +827,7 @@ db_renumber_object(Objid old)
             if (obj2.v.obj == old)                  \
                 break;                      \
             objects[obj1.v.obj]->down.v.list[i2].v.obj = _new;      \
+            dbpriv_mark_dirty(objects[obj1.v.obj]);         \
         }                               \
     }                                   \
     else if (TYPE_OBJ == o->up.type && NOTHING != o->up.v.obj) {    \
@@ -499,6 +835,7 @@ db_renumber_object(Objid old)
         if (obj1.v.obj == old)                      \
             break;                          \
         objects[o->up.v.obj]->down.v.list[i2].v.obj = _new;     \
+        dbpriv_mark_dirty(objects[o->up.v.obj]);            \
     }                                   \
     FOR_EACH(obj1, o->down, i1, c1) {                   \
         if (TYPE_LIST == objects[obj1.v.obj]->up.type) {        \
@@ -510,6 +847,7 @@ db_renumber_object(Objid old)
         else {                              \
             objects[obj1.v.obj]->up.v.obj = _new;           \
         }                               \
+        dbpriv_mark_dirty(objects[obj1.v.obj]);             \
     }
 
             FIX(parents, children);
@@ -517,6 +855,11 @@ db_renumber_object(Objid old)
 
 #undef      FIX
 
+#ifdef USE_ANCESTOR_CACHE
+            /* the old number is among the ancestors of its descendants */
+            forget_ancestors(Var::new_obj(_new));
+#endif /* USE_ANCESTOR_CACHE */
+
             /* Fix up the list of users, if necessary */
             if (is_user(_new)) {
                 int i;
@@ -540,24 +883,24 @@ db_renumber_object(Objid old)
                     if (!o)
                         continue;
 
-                    if (o->owner == _new)
-                        o->owner = NOTHING;
-                    else if (o->owner == old)
-                        o->owner = _new;
+                    if (o->owner == _new || o->owner == old) {
+                        o->owner = o->owner == old ? _new : NOTHING;
+                        dbpriv_mark_dirty(o);
+                    }
 
                     for (v = o->verbdefs; v; v = v->next)
-                        if (v->owner == _new)
-                            v->owner = NOTHING;
-                        else if (v->owner == old)
-                            v->owner = _new;
+                        if (v->owner == _new || v->owner == old) {
+                            v->owner = v->owner == old ? _new : NOTHING;
+                            dbpriv_mark_dirty(o);
+                        }
 
                     p = o->propval;
                     count = o->nval;
                     for (i = 0; i < count; i++)
-                        if (p[i].owner == _new)
-                            p[i].owner = NOTHING;
-                        else if (p[i].owner == old)
-                            p[i].owner = _new;
+                        if (p[i].owner == _new || p[i].owner == old) {
+                            p[i].owner = p[i].owner == old ? _new : NOTHING;
+                            dbpriv_mark_dirty(o);
+                        }
                 }
             }
 
@@ -584,6 +927,8 @@ db_object_bytes(Var obj)
         count += memo_strlen(v->name) + 1;
         if (v->program)
             count += program_bytes(v->program);
+        else if (v->source)
+            count += memo_strlen(v->source) + 1;
     }
 
     count += sizeof(Propdef) * o->propdefs.cur_length;
@@ -623,7 +968,7 @@ db_object_bytes(Var obj)
     db1_count_##name(Object *o)                                              \
     {                                                                        \
         int i, c, n = 0;                                                     \
-        Var tmp, field = enlist_var(var_ref(o->field));                      \
+        Var tmp, field = enlist_var(var_ref(dbpriv_object_##field(o)));                      \
         Object *o2;                                                          \
         Objid oid;                                                           \
                                                                              \
@@ -646,7 +991,7 @@ db_object_bytes(Var obj)
     db2_add_##name(Object *o, Var *plist, int *px)                           \
     {                                                                        \
         int i, c;                                                            \
-        Var tmp, field = enlist_var(var_ref(o->field));                      \
+        Var tmp, field = enlist_var(var_ref(dbpriv_object_##field(o)));                      \
         Object *o2;                                                          \
         Objid oid;                                                           \
                                                                              \
@@ -674,8 +1019,9 @@ db_object_bytes(Var obj)
         Var list;                                                            \
                                                                              \
         o = dbpriv_dereference(obj);                                         \
-        if ((o->field.type == TYPE_OBJ && o->field.v.obj == NOTHING) ||      \
-                (o->field.type == TYPE_LIST && listlength(o->field) == 0))   \
+        Var field = dbpriv_object_##field(o);                                \
+        if ((field.type == TYPE_OBJ && field.v.obj == NOTHING) ||            \
+                (field.type == TYPE_LIST && listlength(field) == 0))         \
             return full ? enlist_var(var_ref(obj)) : new_list(0);            \
                                                                              \
         CLEAR_BIT_ARRAY();                                                   \
@@ -705,16 +1051,38 @@ DEFUNC(all_contents, contents);
 #ifdef USE_ANCESTOR_CACHE
 DEFUNC(find_ancestors, parents);
 
+/* Ancestor lists are cached on each permanent object (and shared with
+ * callers by reference).  Whatever changes an object's parentage, or the
+ * number of one of its ancestors, calls this to drop the lists of that
+ * object and its descendants; nothing else is affected.
+ */
+static void
+forget_ancestors(Var obj)
+{
+    Var desc, descendants = db_descendants(obj, true);
+    int i, c;
+
+    FOR_EACH(desc, descendants, i, c) {
+        Object *o = desc.type == TYPE_OBJ ? dbpriv_find_object(desc.v.obj) : nullptr;
+
+        if (o) {
+            free_var(o->ancestors);
+            o->ancestors = none;
+        }
+    }
+    free_var(descendants);
+}
+
 Var db_ancestors(Var obj, bool full) {
     Object *o = dbpriv_dereference(obj);
 
     if (obj.type != TYPE_OBJ || !is_valid(obj) || o->parents.v.obj == NOTHING)
         return db_find_ancestors(obj, full);
 
-    if (ancestor_cache.count(o->id) == 0)
-        ancestor_cache[o->id] = db_find_ancestors(obj, false);
+    if (o->ancestors.type != TYPE_LIST)
+        o->ancestors = db_find_ancestors(obj, false);
 
-    Var ancestors = var_ref(ancestor_cache[o->id]);
+    Var ancestors = var_ref(o->ancestors);
 
     /* The 'full' refcount only needs to be 1 because listinsert will be creating a new list and consuming
      * the second reference to the cached copy (which we just created directly above this). This leaves us
@@ -792,6 +1160,7 @@ void
 dbpriv_set_object_owner(Object *o, Objid owner)
 {
     o->owner = owner;
+    dbpriv_mark_dirty(o);
 }
 
 Objid
@@ -818,6 +1187,7 @@ dbpriv_set_object_name(Object *o, const char *name)
     if (o->name)
         free_str(o->name);
     o->name = name;
+    dbpriv_mark_dirty(o);
 }
 
 const char *
@@ -841,6 +1211,7 @@ dbpriv_object_parents(Object *o)
 Var
 dbpriv_object_children(Object *o)
 {
+    present(&o->children, &o->children_set);
     return o->children;
 }
 
@@ -859,19 +1230,20 @@ db_object_children(Objid oid)
 int
 db_count_children(Objid oid)
 {
-    return listlength(objects[oid]->children);
+    return count_members(objects[oid]->children, objects[oid]->children_set);
 }
 
 int
 db_for_all_children(Objid oid, int (*func) (void *, Objid), void *data)
 {
-    int i, c = db_count_children(oid);
+    Var children = var_ref(dbpriv_object_children(objects[oid]));
+    int i, c = listlength(children), stopped = 0;
 
-    for (i = 1; i <= c; i++)
-        if (func(data, objects[oid]->children.v.list[i].v.obj))
-            return 1;
+    for (i = 1; i <= c && !stopped; i++)
+        stopped = func(data, children.v.list[i].v.obj);
+    free_var(children);
 
-    return 0;
+    return stopped;
 }
 
 static int
@@ -924,20 +1296,7 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
 
     Object *o = dbpriv_dereference(obj);
 
-    if (o->verbdefs == nullptr
-            && listlength(o->children) == 0
-            && (TYPE_LIST != anon_kids.type || listlength(anon_kids) == 0)) {
-        /* Since this object has no children and no verbs, we know that it
-           can't have had any part in affecting verb lookup, since we use first
-           parent with verbs as a key in the verb lookup cache. */
-        /* The "no kids" rule is necessary because potentially one of the
-           children could have verbs on it--and that child could have cache
-           entries for THIS object's parentage. */
-        /* In any case, don't clear the cache. */
-        ;
-    } else {
-        db_priv_affected_callable_verb_lookup();
-    }
+    db_priv_affected_callable_verb_lookup(obj);
 
     Var old_parents = o->parents;
 
@@ -950,22 +1309,35 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
         int i, c;
 
         /* remove me/obj from my old parents' children */
-        if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING)
-            objects[old_parents.v.obj]->children = setremove(objects[old_parents.v.obj]->children, obj);
+        if (old_parents.type == TYPE_OBJ && old_parents.v.obj != NOTHING) {
+            remove_member(&objects[old_parents.v.obj]->children,
+                          &objects[old_parents.v.obj]->children_set, obj.v.obj);
+            dbpriv_mark_dirty(objects[old_parents.v.obj]);
+        }
         else if (old_parents.type == TYPE_LIST)
-            FOR_EACH(parent, old_parents, i, c)
-            objects[parent.v.obj]->children = setremove(objects[parent.v.obj]->children, obj);
+            FOR_EACH(parent, old_parents, i, c) {
+                remove_member(&objects[parent.v.obj]->children,
+                              &objects[parent.v.obj]->children_set, obj.v.obj);
+                dbpriv_mark_dirty(objects[parent.v.obj]);
+            }
 
         /* add me/obj to my new parents' children */
-        if (new_parents.type == TYPE_OBJ && new_parents.v.obj != NOTHING)
-            objects[new_parents.v.obj]->children = setadd(objects[new_parents.v.obj]->children, obj);
+        if (new_parents.type == TYPE_OBJ && new_parents.v.obj != NOTHING) {
+            add_member(&objects[new_parents.v.obj]->children,
+                       &objects[new_parents.v.obj]->children_set, obj.v.obj);
+            dbpriv_mark_dirty(objects[new_parents.v.obj]);
+        }
         else if (new_parents.type == TYPE_LIST)
-            FOR_EACH(parent, new_parents, i, c)
-            objects[parent.v.obj]->children = setadd(objects[parent.v.obj]->children, obj);
+            FOR_EACH(parent, new_parents, i, c) {
+                add_member(&objects[parent.v.obj]->children,
+                           &objects[parent.v.obj]->children_set, obj.v.obj);
+                dbpriv_mark_dirty(objects[parent.v.obj]);
+            }
     }
 
     free_var(o->parents);
     o->parents = var_dup(new_parents);
+    dbpriv_mark_dirty(o);
 
     /* Nothing between this point and the completion of
      * `dbpriv_fix_properties_after_chparent' may call `anon_valid'
@@ -974,20 +1346,7 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
      */
 
 #ifdef USE_ANCESTOR_CACHE
-    /* Invalidate the cache for all descendants of the object that is changing parents. */
-    Var desc;
-    int i, c;
-
-    Var descendants = db_descendants(obj, true);
-    FOR_EACH(desc, descendants, i, c) {
-        if (ancestor_cache.count(desc.v.obj) > 0) {
-            if (var_refcount(ancestor_cache[desc.v.obj]) > 1)
-                applog(LOG_ERROR, "Refcount too high for ancestor cache invalidation of #%i. Refcount = %i\n", desc.v.obj, var_refcount(ancestor_cache[desc.v.obj]));
-            free_var(ancestor_cache[desc.v.obj]);
-            ancestor_cache.erase(desc.v.obj);
-        }
-    }
-    free_var(descendants);
+    forget_ancestors(obj);
 #endif /* USE_ANCESTOR_CACHE */
 
     Var new_ancestors = db_ancestors(obj, true);
@@ -1021,25 +1380,27 @@ db_object_location(Objid oid)
 Var
 dbpriv_object_contents(Object *o)
 {
+    present(&o->contents, &o->contents_set);
     return o->contents;
 }
 
 int
 db_count_contents(Objid oid)
 {
-    return listlength(objects[oid]->contents);
+    return count_members(objects[oid]->contents, objects[oid]->contents_set);
 }
 
 int
 db_for_all_contents(Objid oid, int (*func) (void *, Objid), void *data)
 {
-    int i, c = db_count_contents(oid);
+    Var contents = var_ref(dbpriv_object_contents(objects[oid]));
+    int i, c = listlength(contents), stopped = 0;
 
-    for (i = 1; i <= c; i++)
-        if (func(data, objects[oid]->contents.v.list[i].v.obj))
-            return 1;
+    for (i = 1; i <= c && !stopped; i++)
+        stopped = func(data, contents.v.list[i].v.obj);
+    free_var(contents);
 
-    return 0;
+    return stopped;
 }
 
 void
@@ -1048,22 +1409,23 @@ db_change_location(Objid oid, Objid new_location, int position)
     static Var time_key = str_dup_to_var("time");
     static Var source_key = str_dup_to_var("source");
 
-    Var me = Var::new_obj(oid);
-
     Objid old_location = objects[oid]->location.v.obj;
 
-    if (valid(old_location))
-        objects[old_location]->contents = setremove(objects[old_location]->contents, var_dup(me));
+    if (valid(old_location)) {
+        remove_member(&objects[old_location]->contents, &objects[old_location]->contents_set,
+                      oid);
+        dbpriv_mark_dirty(objects[old_location]);
+    }
 
     if (valid(new_location)) {
-        if (position <= 0)
-            position = objects[new_location]->contents.v.list[0].v.num + 1;
-
-        objects[new_location]->contents = listinsert(objects[new_location]->contents, me, position);
+        insert_member(&objects[new_location]->contents, &objects[new_location]->contents_set,
+                      oid, position);
+        dbpriv_mark_dirty(objects[new_location]);
     }
 
     free_var(objects[oid]->location);
     objects[oid]->location = Var::new_obj(new_location);
+    dbpriv_mark_dirty(objects[oid]);
     if (!clear_last_move) {
         if (objects[oid]->last_move.type != TYPE_MAP) {
             free_var(objects[oid]->last_move);
@@ -1089,12 +1451,14 @@ void
 dbpriv_set_object_flag(Object *o, db_object_flag f)
 {
     o->flags |= (1 << f);
+    dbpriv_mark_dirty(o);
 }
 
 void
 dbpriv_clear_object_flag(Object *o, db_object_flag f)
 {
     o->flags &= ~(1 << f);
+    dbpriv_mark_dirty(o);
 }
 
 int
@@ -1201,17 +1565,23 @@ db_fixup_owners(const Objid obj)
         if (!o)
             continue;
 
-        if (o->owner == obj)
+        if (o->owner == obj) {
             o->owner = NOTHING;
+            dbpriv_mark_dirty(o);
+        }
 
         for (Verbdef *v = o->verbdefs; v; v = v->next)
-            if (v->owner == obj)
+            if (v->owner == obj) {
                 v->owner = NOTHING;
+                dbpriv_mark_dirty(o);
+            }
 
         p = o->propval;
         for (int i = 0, count = o->nval; i < count; i++)
-            if (p[i].owner == obj)
+            if (p[i].owner == obj) {
                 p[i].owner = NOTHING;
+                dbpriv_mark_dirty(o);
+            }
     }
 }
 
@@ -1219,8 +1589,12 @@ void
 db_clear_ancestor_cache(void)
 {
 #ifdef USE_ANCESTOR_CACHE /*Just in case */
-    for (auto const& x : ancestor_cache)
-        free_var(x.second);
-    ancestor_cache.clear();
+    Objid oid;
+
+    for (oid = 0; oid < num_objects; oid++)
+        if (objects[oid]) {
+            free_var(objects[oid]->ancestors);
+            objects[oid]->ancestors = none;
+        }
 #endif
 }
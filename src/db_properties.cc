@@ -28,16 +28,259 @@
 #include "list.h"
 #include "server.h"
 #include "storage.h"
+#include "str_intern.h"
 #include "utils.h"
 #include "waif.h"
 
+/* Bumped whenever a property is renamed.  Renaming doesn't change the
+ * layout of any object's `propval' (so no nonce changes), but it does
+ * invalidate every cached name-to-slot mapping.
+ */
+static unsigned int prop_cache_generation = 0;
+
+/*********** Property name index ***********/
+
+/* Objects with fewer properties than this (defined and inherited)
+ * don't get an index; a linear scan is just as quick.
+ */
+#define PROP_INDEX_MIN 16
+
+/* The objects whose propdefs were added to an index, in order.  Their
+ * properties are numbered consecutively from 0 in that order; for an
+ * object's own index that number is the slot in its `propval'.
+ */
+typedef struct Propindex_definer {
+    Object *definer;
+    int first;			/* number of its first property */
+} Propindex_definer;
+
+/* An open-addressed table of property numbers, at most three quarters
+ * full.  Names and hashes are read from the definers' propdefs, so an
+ * index is only good while none of them change (see `nonce').
+ */
+struct Propindex {
+    unsigned int nonce;		/* the layout owner's nonce when built */
+    unsigned int generation;	/* `prop_cache_generation' likewise */
+    unsigned int mask;
+    int count;			/* numbers in the table */
+    int length;			/* properties added, duplicates included */
+    int ndefiners, max_definers;
+    Propindex_definer *definers;
+    int slots[1];		/* property numbers; -1 if empty */
+};
+
+static Propindex *
+new_prop_index(int count)
+{
+    unsigned int size = 4;
+    Propindex *pi;
+
+    while (size * 3 < (unsigned)count * 4 + 4)
+        size <<= 1;
+
+    pi = (Propindex *)mymalloc(sizeof(Propindex)
+                               + (size - 1) * sizeof(int),
+                               M_PROP_INDEX);
+    pi->nonce = 0;
+    pi->generation = prop_cache_generation;
+    pi->mask = size - 1;
+    pi->count = 0;
+    pi->length = 0;
+    pi->ndefiners = pi->max_definers = 0;
+    pi->definers = nullptr;
+    memset(pi->slots, -1, size * sizeof(int));
+
+    return pi;
+}
+
+static void
+free_prop_index(Propindex *pi)
+{
+    if (pi->definers)
+        myfree(pi->definers, M_PROP_INDEX);
+    myfree(pi, M_PROP_INDEX);
+}
+
+void
+dbpriv_free_prop_index(Object *o)
+{
+    if (o->prop_index)
+        free_prop_index(o->prop_index);
+    o->prop_index = nullptr;
+}
+
+/* Returns the propdef numbered `n', and sets `*definer' to its definer
+ * and `*index' to its position there.
+ */
+static Propdef *
+prop_index_def(const Propindex *pi, int n, Object **definer, int *index)
+{
+    int lo = 0, hi = pi->ndefiners - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (pi->definers[mid].first <= n)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    *definer = pi->definers[lo].definer;
+    *index = n - pi->definers[lo].first;
+    return (*definer)->propdefs.l + *index;
+}
+
+/* Returns the number of the property called `name', or -1. */
+static int
+prop_index_find(const Propindex *pi, const char *name, int hash,
+                Object **definer, int *index)
+{
+    unsigned int i;
+    int n;
+
+    for (i = hash & pi->mask; (n = pi->slots[i]) >= 0; i = (i + 1) & pi->mask) {
+        Propdef *d = prop_index_def(pi, n, definer, index);
+
+        if (d->hash == hash && (d->name == name || !strcasecmp(d->name, name)))
+            return n;
+    }
+
+    return -1;
+}
+
+static void
+prop_index_insert(Propindex *pi, int hash, int n)
+{
+    unsigned int i;
+
+    for (i = hash & pi->mask; pi->slots[i] >= 0; i = (i + 1) & pi->mask)
+        ;
+    pi->slots[i] = n;
+    pi->count++;
+}
+
+/*
+ * Adds the properties defined on `definer' to `*pip', growing it if
+ * necessary, and returns how many of their names were already there.
+ * Those keep their first definition, just as in a linear scan.
+ */
+static int
+index_propdefs(Propindex **pip, Object *definer)
+{
+    Propindex *pi = *pip;
+    Proplist *props = &(definer->propdefs);
+    Object *d;
+    int i, x, duplicates = 0;
+
+    if (props->cur_length == 0)
+        return 0;
+
+    if ((unsigned)(pi->count + props->cur_length) * 4 > (pi->mask + 1) * 3) {
+        Propindex *bigger = new_prop_index(pi->count + props->cur_length);
+
+        for (i = 0; i <= (int) pi->mask; i++)
+            if (pi->slots[i] >= 0)
+                prop_index_insert(bigger, prop_index_def(pi, pi->slots[i], &d, &x)->hash,
+                                  pi->slots[i]);
+        bigger->nonce = pi->nonce;
+        bigger->generation = pi->generation;
+        bigger->length = pi->length;
+        bigger->ndefiners = pi->ndefiners;
+        bigger->max_definers = pi->max_definers;
+        bigger->definers = pi->definers;
+        myfree(pi, M_PROP_INDEX);
+        *pip = pi = bigger;
+    }
+
+    if (pi->ndefiners == pi->max_definers) {
+        Propindex_definer *more;
+
+        pi->max_definers = pi->max_definers ? pi->max_definers * 2 : 4;
+        more = (Propindex_definer *)mymalloc(pi->max_definers * sizeof(Propindex_definer),
+                                             M_PROP_INDEX);
+        if (pi->definers) {
+            memcpy(more, pi->definers, pi->ndefiners * sizeof(Propindex_definer));
+            myfree(pi->definers, M_PROP_INDEX);
+        }
+        pi->definers = more;
+    }
+    pi->definers[pi->ndefiners].definer = definer;
+    pi->definers[pi->ndefiners].first = pi->length;
+    pi->ndefiners++;
+
+    for (i = 0; i < props->cur_length; i++, pi->length++) {
+        if (prop_index_find(pi, props->l[i].name, props->l[i].hash, &d, &x) >= 0)
+            duplicates++;
+        else
+            prop_index_insert(pi, props->l[i].hash, pi->length);
+    }
+
+    return duplicates;
+}
+
+/*
+ * Returns the object whose property layout `o' has.  An object that
+ * defines no properties and has a single parent lays its values out
+ * exactly as that parent does, so instances of a class share their
+ * class's layout, and with it its index and its inline cache entries.
+ * Anything that changes a layout gives the objects concerned (the
+ * owner, and all its descendants with it) new nonces.
+ */
+static Object *
+layout_owner(Object *o)
+{
+    while (o->propdefs.cur_length == 0
+            && TYPE_OBJ == o->parents.type && valid(o->parents.v.obj))
+        o = dbpriv_find_object(o->parents.v.obj);
+
+    return o;
+}
+
+/*
+ * Returns the property index for `o's layout, (re)building it if it is
+ * missing or stale.  It is kept on the layout owner and laid out by the
+ * same walk over the owner and its ancestors that `find_property()'
+ * would make, so numbers are slots.
+ */
+static Propindex *
+object_prop_index(Var obj, Object *o)
+{
+    Object *owner = layout_owner(o);
+    Propindex *pi = owner->prop_index;
+
+    if (pi && pi->nonce == owner->nonce && pi->generation == prop_cache_generation)
+        return pi;
+
+    if (owner != o)
+        obj = Var::new_obj(owner->id);
+
+    dbpriv_free_prop_index(owner);
+    pi = new_prop_index(owner->nval);
+
+    Var ancestor, ancestors = db_ancestors(obj, false);
+    int i, c;
+
+    index_propdefs(&pi, owner);
+    FOR_EACH(ancestor, ancestors, i, c) {
+        if (!is_valid(ancestor))
+            continue;
+        index_propdefs(&pi, dbpriv_dereference(ancestor));
+    }
+
+    free_var(ancestors);
+
+    pi->nonce = owner->nonce;
+    return owner->prop_index = pi;
+}
+
 Propdef
 dbpriv_new_propdef(const char *name)
 {
     Propdef newprop;
 
-    newprop.name = str_ref(name);
-    newprop.hash = str_hash(name);
+    newprop.name = str_intern_name(str_ref(name));
+    newprop.hash = memo_str_hash(name);
     return newprop;
 }
 
@@ -67,21 +310,19 @@ properties_offset(Var target, Var _this)
 }
 
 /*
- * Returns true iff `o' defines a property named `pname'.
+ * Adds the names of the properties defined on `o' and all of its
+ * descendants to `*pip', for membership tests.
  */
-static int
-property_defined_at(const char *pname, int phash, Object *o)
+static void
+index_names_at_or_below(Propindex **pip, Object *o)
 {
-    Proplist *props = &(o->propdefs);
-    int length = props->cur_length;
-    int i;
+    Var child, children = dbpriv_object_children(o);
+    int i, c;
 
-    for (i = 0; i < length; i++)
-        if (props->l[i].hash == phash
-                && !strcasecmp(props->l[i].name, pname))
-            return 1;
+    index_propdefs(pip, o);
 
-    return 0;
+    FOR_EACH(child, children, i, c)
+    index_names_at_or_below(pip, dbpriv_dereference(child));
 }
 
 /*
@@ -100,7 +341,7 @@ property_defined_at_or_below(const char *pname, int phash, Object *o)
                 && !strcasecmp(props->l[i].name, pname))
             return 1;
 
-    Var children = o->children;
+    Var children = dbpriv_object_children(o);
     for (i = 1; i <= children.v.list[0].v.num; i++) {
         Object *child = dbpriv_dereference(children.v.list[i]);
         if (property_defined_at_or_below(pname, phash, child))
@@ -257,8 +498,10 @@ db_rename_propdef(Var obj, const char *old, const char *_new)
             }
             rename_waif_prop_recursively(obj, props->l[i].name, _new);
             free_str(props->l[i].name);
-            props->l[i].name = str_ref(_new);
-            props->l[i].hash = str_hash(_new);
+            props->l[i].name = str_intern_name(str_ref(_new));
+            props->l[i].hash = memo_str_hash(_new);
+            prop_cache_generation++;
+            dbpriv_mark_dirty(o);
 
             return 1;
         }
@@ -467,12 +710,71 @@ get_bi_value(db_prop_handle h, Var * value)
     }
 }
 
-/* does NOT consume `obj' and `name' */
-db_prop_handle
-db_find_property(Var obj, const char *name, Var *value)
+/*
+ * Follows `clear' slots up the parent chain, starting at the slot `h'
+ * refers to in `o'.  `index' is the position of the property among
+ * its definer's propdefs.
+ */
+static void
+resolve_property_value(Object *o, db_prop_handle h, int index, Var *value)
+{
+    Pval *prop = (Pval *)h.ptr;
+
+    while (prop->var.type == TYPE_CLEAR) {
+        /* We take a few liberties at this point.  If a property
+         * value on an object is clear, then its `definer' must be
+         * a permanent (not an anonymous) object, because
+         * anonymous objects can't currently be parents of other
+         * objects.  Thus `new_obj()' below is okay.
+         */
+        if (TYPE_LIST == o->parents.type) {
+            Var parent, parents = o->parents;
+            int i2, c2, offset = 0;
+            FOR_EACH(parent, parents, i2, c2)
+            if ((offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), parent)) > -1)
+                break;
+            o = dbpriv_find_object(parent.v.obj);
+            prop = o->propval + offset + index;
+        }
+        else if (TYPE_OBJ == o->parents.type && NOTHING != o->parents.v.obj) {
+            int offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), o->parents);
+            o = dbpriv_find_object(o->parents.v.obj);
+            prop = o->propval + offset + index;
+        }
+    }
+    *value = prop->var;
+}
+
+/* Identifies `o's property layout for the inline caches. */
+static unsigned int
+prop_layout(Object *o)
+{
+    return layout_owner(o)->nonce;
+}
+
+static void
+fill_prop_cache(db_prop_cache *cache, const char *name, Object *o,
+                db_prop_handle h, int offset, int index)
+{
+    if (cache->name != name) {
+        if (cache->name)
+            free_str(cache->name);
+        cache->name = str_ref(name);
+    }
+    cache->generation = prop_cache_generation;
+    cache->layout = prop_layout(o);
+    cache->built_in = h.built_in;
+    cache->definer = h.definer;
+    cache->offset = offset;
+    cache->index = index;
+}
+
+/* does NOT consume `obj' and `name'; `hash' is str_hash(name) */
+static db_prop_handle
+find_property(Var obj, const char *name, int hash, Var *value,
+              db_prop_cache *cache)
 {
     Object *o = dbpriv_dereference(obj);
-    int hash = str_hash(name);
 
     static struct {
         const char *name;
@@ -495,11 +797,14 @@ db_find_property(Var obj, const char *name, Var *value)
 
     h.definer = nullptr;
     h.ptr = nullptr;
+    h.object = o;
 
     for (i = 0; i < Arraysize(ptable); i++) {
         if (ptable[i].hash == hash && !strcasecmp(name, ptable[i].name)) {
             h.built_in = ptable[i].prop;
             h.ptr = o;
+            if (cache)
+                fill_prop_cache(cache, name, o, h, 0, 0);
             if (value)
                 get_bi_value(h, value);
             return h;
@@ -508,6 +813,25 @@ db_find_property(Var obj, const char *name, Var *value)
 
     h.built_in = BP_NONE;
 
+    if (o->nval >= PROP_INDEX_MIN) {
+        Object *definer;
+
+        n = prop_index_find(object_prop_index(obj, o), name, hash, &definer, &i);
+        if (n < 0)
+            return h;
+
+        h.definer = definer;
+        h.ptr = o->propval + n;
+
+        if (cache)
+            fill_prop_cache(cache, name, o, h, n, i);
+
+        if (value)
+            resolve_property_value(o, h, i, value);
+
+        return h;
+    }
+
     Var ancestor, ancestors = db_ancestors(obj, false);
 
     Proplist *props = &(o->propdefs);
@@ -517,7 +841,8 @@ db_find_property(Var obj, const char *name, Var *value)
     n = 0;
 
     for (i = 0; i < length; i++, n++) {
-        if (defs[i].hash == hash && !strcasecmp(defs[i].name, name)) {
+        if (defs[i].hash == hash
+                && (defs[i].name == name || !strcasecmp(defs[i].name, name))) {
             h.definer = o;
             h.ptr = o->propval + n;
             goto done;
@@ -538,7 +863,8 @@ db_find_property(Var obj, const char *name, Var *value)
         length = props->cur_length;
 
         for (i = 0; i < length; i++, n++) {
-            if (defs[i].hash == hash && !strcasecmp(defs[i].name, name)) {
+            if (defs[i].hash == hash
+                && (defs[i].name == name || !strcasecmp(defs[i].name, name))) {
                 h.definer = t;
                 h.ptr = o->propval + n;
                 goto done;
@@ -553,35 +879,58 @@ done:
     if (!h.ptr)
         return h;
 
-    if (value) {
-        Pval *prop = (Pval *)h.ptr;
+    if (cache)
+        fill_prop_cache(cache, name, o, h, n, i);
 
-        while (prop->var.type == TYPE_CLEAR) {
-            /* We take a few liberties at this point.  If a property
-             * value on an object is clear, then its `definer' must be
-             * a permanent (not an anonymous) object, because
-             * anonymous objects can't currently be parents of other
-             * objects.  Thus `new_obj()' below is okay.
-             */
-            if (TYPE_LIST == o->parents.type) {
-                Var parent, parents = o->parents;
-                int i2, c2, offset = 0;
-                FOR_EACH(parent, parents, i2, c2)
-                if ((offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), parent)) > -1)
-                    break;
-                o = dbpriv_find_object(parent.v.obj);
-                prop = o->propval + offset + i;
-            }
-            else if (TYPE_OBJ == o->parents.type && NOTHING != o->parents.v.obj) {
-                int offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), o->parents);
-                o = dbpriv_find_object(o->parents.v.obj);
-                prop = o->propval + offset + i;
-            }
+    if (value)
+        resolve_property_value(o, h, i, value);
+
+    return h;
+}
+
+db_prop_handle
+db_find_property(Var obj, const char *name, Var *value)
+{
+    return find_property(obj, name, str_hash(name), value, nullptr);
+}
+
+db_prop_handle
+db_find_property_cached(Var obj, const char *name, Var *value,
+                        db_prop_cache *cache)
+{
+    Object *o = dbpriv_dereference(obj);
+    db_prop_handle h;
+
+    if (cache->name == name && cache->generation == prop_cache_generation) {
+        if (cache->built_in) {
+            h.built_in = cache->built_in;
+            h.definer = nullptr;
+            h.ptr = o;
+            h.object = o;
+            if (value)
+                get_bi_value(h, value);
+            return h;
+        }
+        if (cache->layout == prop_layout(o)) {
+            h.built_in = BP_NONE;
+            h.definer = cache->definer;
+            h.ptr = o->propval + cache->offset;
+            h.object = o;
+            if (value)
+                resolve_property_value(o, h, cache->index, value);
+            return h;
         }
-        *value = prop->var;
     }
 
-    return h;
+    return find_property(obj, name, memo_str_hash(name), value, cache);
+}
+
+void
+db_clear_prop_cache(db_prop_cache *cache)
+{
+    if (cache->name)
+        free_str(cache->name);
+    cache->name = nullptr;
 }
 
 int
@@ -619,7 +968,8 @@ db_set_property_value(db_prop_handle h, Var value)
         Pval *prop = (Pval *)h.ptr;
 
         free_var(prop->var);
-        prop->var = value;
+        prop->var = value.type == TYPE_LIST ? list_compact(value) : value;
+        dbpriv_mark_dirty((Object *)h.object);
     } else {
         Object *o = (Object *)h.ptr;
         db_object_flag flag;
@@ -693,6 +1043,7 @@ db_set_property_owner(db_prop_handle h, Objid oid)
         Pval *prop = (Pval *)h.ptr;
 
         prop->owner = oid;
+        dbpriv_mark_dirty((Object *)h.object);
     }
 }
 
@@ -718,6 +1069,7 @@ db_set_property_flags(db_prop_handle h, unsigned flags)
         Pval *prop = (Pval *)h.ptr;
 
         prop->perms = flags;
+        dbpriv_mark_dirty((Object *)h.object);
     }
 }
 
@@ -758,64 +1110,51 @@ dbpriv_check_properties_for_chparent(Var obj, Var parents, Var anon_kids)
 
     free_var(stack);
 
-    int has_kids = (TYPE_LIST == anon_kids.type && listlength(anon_kids) > 0);
-    Object *o2, *o3, *o = dbpriv_dereference(obj);
+    Object *o = dbpriv_dereference(obj);
+    Propindex *below, *above;
     Proplist *props;
-    Var ancestor;
-    int i, c, x;
-    int i2, c2;
+    Var ancestor, kid;
+    Object *d;
+    int i, c, x, y;
+    int ok = 1;
 
-    /* check props in descendants & anonymous children */
+    /* gather the names defined by `obj', its descendants, and its
+     * anonymous children
+     */
+    below = new_prop_index(o->propdefs.cur_length);
+    index_names_at_or_below(&below, o);
+    if (TYPE_LIST == anon_kids.type)
+        FOR_EACH(kid, anon_kids, i, c)
+        index_propdefs(&below, dbpriv_dereference(kid));
+
+    /* check them against the props in the new ancestors, which must
+     * not collide with each other, either
+     */
+    above = new_prop_index(0);
 
     FOR_EACH(ancestor, ancestors, i, c) {
-        o2 = dbpriv_dereference(ancestor);
-        props = &o2->propdefs;
+        Object *a = dbpriv_dereference(ancestor);
 
-        for (x = 0; x < props->cur_length; x++) {
-            if (property_defined_at_or_below(props->l[x].name,
-                                             props->l[x].hash,
-                                             o)) {
-                free_var(ancestors);
-                return 0;
-            }
+        props = &(a->propdefs);
 
-            if (has_kids) {
-                FOR_EACH(obj, anon_kids, i2, c2) {
-                    o3 = dbpriv_dereference(obj);
-                    if (property_defined_at(props->l[x].name,
-                                            props->l[x].hash,
-                                            o3)) {
-                        free_var(ancestors);
-                        return 0;
-                    }
-                }
+        for (x = 0; x < props->cur_length; x++) {
+            if (prop_index_find(below, props->l[x].name, props->l[x].hash, &d, &y) >= 0) {
+                ok = 0;
+                goto done;
             }
         }
-    }
-
-    /* check props in parents */
-
-    FOR_EACH(ancestor, ancestors, i, c) {
-        o2 = dbpriv_dereference(ancestor);
-        props = &o2->propdefs;
-
-        FOR_EACH(obj, ancestors, i2, c2) {
-            if (equality(obj, ancestor, 0))
-                continue;
-            o3 = dbpriv_dereference(obj);
-            for (x = 0; x < props->cur_length; x++) {
-                if (property_defined_at(props->l[x].name,
-                                        props->l[x].hash,
-                                        o3)) {
-                    free_var(ancestors);
-                    return 0;
-                }
-            }
+        if (index_propdefs(&above, a) > 0) {
+            ok = 0;
+            goto done;
         }
     }
 
+done:
+    free_prop_index(below);
+    free_prop_index(above);
+
     free_var(ancestors);
-    return 1;
+    return ok;
 }
 
 /*
@@ -984,9 +1323,9 @@ dbpriv_fix_properties_after_chparent(Var obj, Var old_ancestors, Var new_ancesto
     Var children;
 
     if (TYPE_LIST == anon_kids.type)
-        children = listconcat(var_ref(me->children), var_ref(anon_kids));
+        children = listconcat(var_ref(dbpriv_object_children(me)), var_ref(anon_kids));
     else
-        children = var_ref(me->children);
+        children = var_ref(dbpriv_object_children(me));
 
     FOR_EACH(child, children, i4, c4) {
         Object *oc = dbpriv_dereference(child);
@@ -27,6 +27,7 @@
 
 #include "config.h"
 #include "db.h"
+#include "db_io.h"
 #include "db_private.h"
 #include "db_tune.h"
 #include "list.h"
@@ -205,7 +206,7 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
     Verbdef *v, *newv;
     int count;
 
-    db_priv_affected_callable_verb_lookup();
+    db_priv_affected_callable_verb_lookup(obj);
 
     newv = (Verbdef *)mymalloc(sizeof(Verbdef), M_VERBDEF);
     newv->name = vnames;
@@ -214,6 +215,9 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
     newv->prep = prep;
     newv->next = nullptr;
     newv->program = nullptr;
+    newv->source = nullptr;
+    newv->unparsable = false;
+    newv->edited = true;
     if (o->verbdefs) {
         for (v = o->verbdefs, count = 2; v->next; v = v->next, ++count);
         v->next = newv;
@@ -221,6 +225,8 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
         o->verbdefs = newv;
         count = 1;
     }
+    dbpriv_mark_dirty(o);
+
     return count;
 }
 
@@ -281,7 +287,7 @@ db_delete_verb(db_verb_handle vh)
     Verbdef *v = h->verbdef;
     Verbdef *vv;
 
-    db_priv_affected_callable_verb_lookup();
+    db_priv_affected_callable_verb_lookup(db_verb_definer(vh));
 
     vv = o->verbdefs;
     if (vv == v)
@@ -291,9 +297,13 @@ db_delete_verb(db_verb_handle vh)
             vv = vv->next;
         vv->next = v->next;
     }
+    dbpriv_mark_verbs_edited(o);
+    dbpriv_mark_dirty(o);
 
     if (v->program)
         free_program(v->program);
+    if (v->source)
+        free_str(v->source);
     if (v->name)
         free_str(v->name);
     myfree(v, M_VERBDEF);
@@ -342,20 +352,27 @@ db_find_command_verb(Objid oid, const char *verb,
     return vh;
 }
 
+static unsigned int verb_stamp = 0;
+
+void
+dbpriv_assign_verb_stamp(Object *o)
+{
+    o->verb_stamp = verb_stamp++;
+}
+
 #ifdef VERB_CACHE
 int db_verb_generation = 0;
 
 int verbcache_hit = 0;
 int verbcache_neg_hit = 0;
 int verbcache_miss = 0;
+int verbcache_invalidated = 0;
 
 typedef struct vc_entry vc_entry;
 
 struct vc_entry {
     unsigned int hash;
-#ifdef RONG
-    int generation;
-#endif
+    unsigned int stamp;     /* `object->verb_stamp' when the entry was made */
     Object *object;
     char *verbname;
     handle h;
@@ -364,32 +381,83 @@ struct vc_entry {
 
 static vc_entry **vc_table = nullptr;
 static int vc_size = 0;
+static int vc_count = 0;
 
 #define DEFAULT_VC_SIZE 7507
 
-void
-db_priv_affected_callable_verb_lookup(void)
+static void
+free_vc_entry(vc_entry *vc)
+{
+    free_str(vc->verbname);
+    myfree(vc, M_VC_ENTRY);
+    vc_count--;
+}
+
+/* Stale entries are normally discarded when a lookup runs into them.
+ * Once the table is carrying more than its share of entries, sweep out
+ * the ones nobody has looked for since they went stale.
+ */
+static void
+sweep_stale_vc_entries(void)
 {
     int i;
-    vc_entry *vc, *vc_next;
+    vc_entry *vc, **vcp;
 
-    if (vc_table == nullptr)
-        return;
+    for (i = 0; i < vc_size; i++) {
+        for (vcp = &vc_table[i]; (vc = *vcp);) {
+            if (vc->stamp != vc->object->verb_stamp) {
+                *vcp = vc->next;
+                free_vc_entry(vc);
+                verbcache_invalidated++;
+            } else
+                vcp = &vc->next;
+        }
+    }
+}
 
-    db_verb_generation++;
+void
+dbpriv_forget_cached_verbs(Object *o)
+{
+    int i;
+    vc_entry *vc, **vcp;
 
     for (i = 0; i < vc_size; i++) {
-        vc = vc_table[i];
-        while (vc) {
-            vc_next = vc->next;
-            free_str(vc->verbname);
-            myfree(vc, M_VC_ENTRY);
-            vc = vc_next;
+        for (vcp = &vc_table[i]; (vc = *vcp);) {
+            if (vc->object == o) {
+                *vcp = vc->next;
+                free_vc_entry(vc);
+                verbcache_invalidated++;
+            } else
+                vcp = &vc->next;
         }
-        vc_table[i] = nullptr;
     }
 }
+#endif /* VERB_CACHE */
+
+void
+db_priv_affected_callable_verb_lookup(Var obj)
+{
+    Object *o = dbpriv_dereference(obj);
+
+    dbpriv_assign_verb_stamp(o);
+
+    /* anonymous objects have no descendants */
+    if (TYPE_OBJ == obj.type && db_count_children(obj.v.obj) > 0) {
+        Var desc, descendants = db_descendants(obj, false);
+        int i, c;
+
+        FOR_EACH(desc, descendants, i, c)
+        dbpriv_assign_verb_stamp(dbpriv_find_object(desc.v.obj));
+
+        free_var(descendants);
+    }
+
+#ifdef VERB_CACHE
+    db_verb_generation++;
+#endif
+}
 
+#ifdef VERB_CACHE
 static void
 make_vc_table(int size)
 {
@@ -424,7 +492,7 @@ db_verb_cache_stats(void)
         histogram[depth]++;
     }
 
-    v = new_list(5);
+    v = new_list(6);
     v.v.list[1].type = TYPE_INT;
     v.v.list[1].v.num = verbcache_hit;
     v.v.list[2].type = TYPE_INT;
@@ -438,6 +506,8 @@ db_verb_cache_stats(void)
         vv.v.list[i + 1].type = TYPE_INT;
         vv.v.list[i + 1].v.num = histogram[i];
     }
+    v.v.list[6].type = TYPE_INT;
+    v.v.list[6].v.num = verbcache_invalidated;
     return v;
 }
 
@@ -460,8 +530,8 @@ db_log_cache_stats(void)
         histogram[depth]++;
     }
 
-    oklog("Verb cache stat summary: %d hits, %d misses, %d generations\n",
-          verbcache_hit, verbcache_miss, db_verb_generation);
+    oklog("Verb cache stat summary: %d hits, %d misses, %d invalidated, %d generations\n",
+          verbcache_hit, verbcache_miss, verbcache_invalidated, db_verb_generation);
     oklog("Depth   Count\n");
     for (i = 0; i < VC_CACHE_STATS_MAX + 1; i++)
         oklog("%-5d   %-5d\n", i, histogram[i]);
@@ -523,9 +593,9 @@ find_callable_verbdef(Object *start, const char *verb)
     return data;
 }
 
-/* does NOT consume `recv' and `verb' */
-db_verb_handle
-db_find_callable_verb(Var recv, const char *verb)
+/* does NOT consume `recv' and `verb'; `verb_hash' is str_hash(verb) */
+static db_verb_handle
+find_callable_verb(Var recv, const char *verb, unsigned verb_hash)
 {
     if (!recv.is_object())
         panic_moo("DB_FIND_CALLABLE_VERB: Not an object!");
@@ -533,9 +603,8 @@ db_find_callable_verb(Var recv, const char *verb)
     Object *o;
 #ifdef VERB_CACHE
     vc_entry *new_vc;
-#else
-    static handle h;
 #endif
+    static handle h;
     db_verb_handle vh;
 
 #ifdef VERB_CACHE
@@ -573,25 +642,49 @@ try_again:
             continue;
         }
 
+        bool anonymous = TYPE_ANON == top.type;
+
         free_var(top);
 
         assert(o != nullptr);
 
+        if (anonymous) {
+            /* Anonymous objects are never parents, so they can only be
+             * a starting point here; their lookups are not cached.
+             */
+            struct verbdef_definer_data data = find_callable_verbdef(o, verb);
+            if (data.o != nullptr && data.v != nullptr) {
+                free_var(stack);
+                h.definer = data.o;
+                h.verbdef = data.v;
+                vh.ptr = &h;
+                return vh;
+            }
+            continue;
+        }
+
         unsigned long first_parent_with_verbs = (unsigned long)o;
 
         /* found something with verbdefs, now check the cache */
         unsigned int hash, bucket;
-        vc_entry *vc;
+        vc_entry *vc, **vcp;
 
         if (vc_table == nullptr)
             make_vc_table(DEFAULT_VC_SIZE);
 
-        hash = str_hash(verb) ^ (~first_parent_with_verbs); /* ewww, but who cares */
+        hash = verb_hash ^ (~first_parent_with_verbs); /* ewww, but who cares */
         bucket = hash % vc_size;
 
-        for (vc = vc_table[bucket]; vc; vc = vc->next) {
+        for (vcp = &vc_table[bucket]; (vc = *vcp); vcp = &vc->next) {
             if (hash == vc->hash
                     && o == vc->object && !strcasecmp(verb, vc->verbname)) {
+                if (vc->stamp != o->verb_stamp) {
+                    /* something along this lookup path has changed */
+                    *vcp = vc->next;
+                    free_vc_entry(vc);
+                    verbcache_invalidated++;
+                    break;
+                }
                 /* we haaave a winnaaah */
                 if (vc->h.verbdef) {
                     verbcache_hit++;
@@ -611,6 +704,9 @@ try_again:
         /* a swing and a miss */
         verbcache_miss++;
 
+        if (vc_count > 2 * vc_size)
+            sweep_stale_vc_entries();
+
 #else
     if (recv.is_object() && is_valid(recv))
         o = dbpriv_dereference(recv);
@@ -628,11 +724,13 @@ try_again:
         new_vc = (vc_entry *)mymalloc(sizeof(vc_entry), M_VC_ENTRY);
 
         new_vc->hash = hash;
+        new_vc->stamp = o->verb_stamp;
         new_vc->object = o;
         new_vc->verbname = str_dup(verb);
         new_vc->h.verbdef = nullptr;
         new_vc->next = vc_table[bucket];
         vc_table[bucket] = new_vc;
+        vc_count++;
 #endif
 
         struct verbdef_definer_data data = find_callable_verbdef(o, verb);
@@ -667,6 +765,70 @@ try_again:
     return vh;
 }
 
+db_verb_handle
+db_find_callable_verb(Var recv, const char *verb)
+{
+    return find_callable_verb(recv, verb, str_hash(verb));
+}
+
+db_verb_handle
+db_find_callable_verb_cached(Objid recv, const char *verb, db_verb_cache *cache)
+{
+    static handle h;
+    db_verb_handle vh;
+    Object *o = dbpriv_find_object(recv);
+    int i;
+
+    if (cache->name == verb) {
+        for (i = 0; i < VERB_CACHE_WAYS; i++) {
+            if (cache->ways[i].recv == recv && cache->ways[i].verbdef
+                    && cache->ways[i].stamp == o->verb_stamp) {
+                h.definer = (Object *)cache->ways[i].definer;
+                h.verbdef = (Verbdef *)cache->ways[i].verbdef;
+                vh.ptr = &h;
+                return vh;
+            }
+        }
+    } else {
+        /* a different verb (or an empty entry) -- start over */
+        if (cache->name)
+            free_str(cache->name);
+        cache->name = str_ref(verb);
+        cache->next = 0;
+        for (i = 0; i < VERB_CACHE_WAYS; i++)
+            cache->ways[i].verbdef = nullptr;
+    }
+
+    vh = find_callable_verb(Var::new_obj(recv), verb, memo_str_hash(verb));
+
+    if (vh.ptr) {
+        handle *found = (handle *)vh.ptr;
+
+        /* reuse a stale way for this receiver, if there is one */
+        for (i = 0; i < VERB_CACHE_WAYS; i++)
+            if (cache->ways[i].recv == recv && cache->ways[i].verbdef)
+                break;
+        if (i == VERB_CACHE_WAYS) {
+            i = cache->next;
+            cache->next = (i + 1) % VERB_CACHE_WAYS;
+        }
+        cache->ways[i].recv = recv;
+        cache->ways[i].stamp = o->verb_stamp;
+        cache->ways[i].definer = found->definer;
+        cache->ways[i].verbdef = found->verbdef;
+    }
+
+    return vh;
+}
+
+void
+db_clear_verb_cache(db_verb_cache *cache)
+{
+    if (cache->name)
+        free_str(cache->name);
+    cache->name = nullptr;
+}
+
 db_verb_handle
 db_find_defined_verb(Var obj, const char *vname, int allow_numbers)
 {
@@ -759,12 +921,14 @@ db_set_verb_names(db_verb_handle vh, const char *names)
 {
     handle *h = (handle *) vh.ptr;
 
-    db_priv_affected_callable_verb_lookup();
+    if (h)
+        db_priv_affected_callable_verb_lookup(db_verb_definer(vh));
 
     if (h) {
         if (h->verbdef->name)
             free_str(h->verbdef->name);
         h->verbdef->name = names;
+        dbpriv_mark_dirty(h->definer);
     } else
         panic_moo("DB_SET_VERB_NAMES: Null handle!");
 }
@@ -786,9 +950,10 @@ db_set_verb_owner(db_verb_handle vh, Objid owner)
 {
     handle *h = (handle *) vh.ptr;
 
-    if (h)
+    if (h) {
         h->verbdef->owner = owner;
-    else
+        dbpriv_mark_dirty(h->definer);
+    } else
         panic_moo("DB_SET_VERB_OWNER: Null handle!");
 }
 
@@ -809,15 +974,54 @@ db_set_verb_flags(db_verb_handle vh, unsigned flags)
 {
     handle *h = (handle *) vh.ptr;
 
-    db_priv_affected_callable_verb_lookup();
+    if (h)
+        db_priv_affected_callable_verb_lookup(db_verb_definer(vh));
 
     if (h) {
         h->verbdef->perms &= ~PERMMASK;
         h->verbdef->perms |= flags;
+        dbpriv_mark_dirty(h->definer);
     } else
         panic_moo("DB_SET_VERB_FLAGS: Null handle!");
 }
 
+/*
+ * Compiles the source text kept for a verb whose program was not
+ * built when the database was loaded.  If the text doesn't parse, it
+ * is kept (so that it is written back out intact), the failure is
+ * logged once, and the verb runs as an empty program without being
+ * parsed again until it is reprogrammed.
+ */
+static Program *
+compile_verb_source(handle *h)
+{
+    Verbdef *v = h->verbdef;
+    static Stream *s = nullptr;
+
+    if (v->unparsable)
+        return nullptr;
+
+    if (!s)
+        s = new_stream(100);
+
+    stream_printf(s, "#%" PRIdN ":%s", h->definer->id, v->name);
+    v->program = dbio_parse_program_text(current_db_version, v->source,
+                                         nullptr, (void *)stream_contents(s));
+    if (v->program) {
+        free_str(v->source);
+        v->source = nullptr;
+    } else {
+        errlog("DB_VERB_PROGRAM: Unparsable program %s; "
+               "it will do nothing until it is reprogrammed.\n",
+               stream_contents(s));
+        v->unparsable = true;
+    }
+
+    reset_stream(s);
+
+    return v->program;
+}
+
 Program *
 db_verb_program(db_verb_handle vh)
 {
@@ -826,6 +1030,9 @@ db_verb_program(db_verb_handle vh)
     if (h) {
         Program *p = h->verbdef->program;
 
+        if (!p && h->verbdef->source)
+            p = compile_verb_source(h);
+
         return p ? p : null_program();
     }
     panic_moo("DB_VERB_PROGRAM: Null handle!");
@@ -841,10 +1048,41 @@ db_set_verb_program(db_verb_handle vh, Program * program)
         if (h->verbdef->program)
             free_program(h->verbdef->program);
         h->verbdef->program = program;
+        h->verbdef->unparsable = false;
+        h->verbdef->edited = true;
+        if (h->verbdef->source) {
+            free_str(h->verbdef->source);
+            h->verbdef->source = nullptr;
+        }
+        dbpriv_mark_dirty(h->definer);
     } else
         panic_moo("DB_SET_VERB_PROGRAM: Null handle!");
 }
 
+void
+dbpriv_set_verb_source(db_verb_handle vh, const char *source)
+{
+    handle *h = (handle *) vh.ptr;
+
+    if (h->verbdef->program) {
+        free_program(h->verbdef->program);
+        h->verbdef->program = nullptr;
+    }
+    if (h->verbdef->source)
+        free_str(h->verbdef->source);
+    h->verbdef->source = source;
+    h->verbdef->unparsable = false;
+}
+
+void
+dbpriv_mark_verbs_edited(Object *o)
+{
+    Verbdef *v;
+
+    for (v = o->verbdefs; v; v = v->next)
+        v->edited = true;
+}
+
 void
 db_verb_arg_specs(db_verb_handle vh,
                   db_arg_spec * dobj, db_prep_spec * prep, db_arg_spec * iobj)
@@ -865,13 +1103,15 @@ db_set_verb_arg_specs(db_verb_handle vh,
 {
     handle *h = (handle *) vh.ptr;
 
-    db_priv_affected_callable_verb_lookup();
+    if (h)
+        db_priv_affected_callable_verb_lookup(db_verb_definer(vh));
 
     if (h) {
         h->verbdef->perms = ((h->verbdef->perms & PERMMASK)
                              | (dobj << DOBJSHIFT)
                              | (iobj << IOBJSHIFT));
         h->verbdef->prep = prep;
+        dbpriv_mark_dirty(h->definer);
     } else
         panic_moo("DB_SET_VERB_ARG_SPECS: Null handle!");
 }
@@ -23,17 +23,18 @@
 #include "storage.h"
 #include "utils.h"
 
-static Program *program;
-static Expr **expr_stack;
-static int top_expr_stack;
-
-static Byte *hot_byte;
-static void *hot_node;
-static enum {
+/* per-thread, so that a checkpoint can be written by a thread of its own */
+static thread_local Program *program;
+static thread_local Expr **expr_stack;
+static thread_local int top_expr_stack;
+
+static thread_local Byte *hot_byte;
+static thread_local void *hot_node;
+static thread_local enum {
     TOP, ENDBODY, BOTTOM, DONE
 } hot_position;
 
-static int lineno;
+static thread_local int lineno;
 
 static void
 push_expr(Expr * expr)
@@ -660,7 +660,8 @@ call_verb(Objid recv, const char *vname_in, Var _this, Var args, int do_pass)
 }
 
 enum error
-call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool should_thread)
+call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool should_thread,
+           db_verb_cache *cache)
 {
     /* if call succeeds, args will be consumed.  If call fails, args
        will NOT be consumed  -- it must therefore be freed by caller */
@@ -718,7 +719,9 @@ call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool
         if (TYPE_ANON == _this.type && is_valid(_this))
             h = db_find_callable_verb(_this, vname);
         else if (valid(recv))
-            h = db_find_callable_verb(Var::new_obj(recv), vname);
+            h = cache
+                ? db_find_callable_verb_cached(recv, vname, cache)
+                : db_find_callable_verb(Var::new_obj(recv), vname);
         else
             return E_INVIND;
     }
@@ -961,8 +964,116 @@ run(char raise, enum error resumption_error, Var * result)
 
 #define JUMP(label)     (bv = bc.vector + label)
 
+    /* fetch the next opcode and charge for it, if it costs a tick */
+#define FETCH_OPCODE()                                  \
+    do {                                                \
+        error_bv = bv;                                  \
+        op = (Opcode)(*bv++);                           \
+        if (COUNT_TICK(op)) {                           \
+            if (--ticks_remaining <= 0) {               \
+                STORE_STATE_VARIABLES();                \
+                abort_task(ABORT_TICKS);                \
+                return OUTCOME_ABORTED;                 \
+            }                                           \
+            if (task_timed_out) {                       \
+                STORE_STATE_VARIABLES();                \
+                abort_task(ABORT_SECONDS);              \
+                return OUTCOME_ABORTED;                 \
+            }                                           \
+        }                                               \
+    } while (0)
+
+    /* With THREADED_DISPATCH, every handler ends by fetching the next
+       opcode and jumping straight to its handler through `dispatch_table',
+       giving each handler its own (separately predicted) indirect branch.
+       Otherwise DISPATCH() is a plain `break' back to the switch. */
+#ifdef USE_COMPUTED_GOTO
+#define TARGET(name)    name:
+#define DISPATCH()                          \
+    do {                                    \
+        FETCH_OPCODE();                     \
+        goto *dispatch_table[op];           \
+    } while (0)
+#else
+#define TARGET(name)
+#define DISPATCH()      break
+#endif
+
     /* end of major run() macros */
 
+#ifdef USE_COMPUTED_GOTO
+    static const void *dispatch_table[Last_Opcode + 1];
+    static bool dispatch_table_ready = false;
+
+    if (!dispatch_table_ready) {
+        int i;
+
+        for (i = 0; i <= Last_Opcode; i++)
+            dispatch_table[i] = &&op_default;
+
+        dispatch_table[OP_IF_QUES] = &&op_test;
+        dispatch_table[OP_IF] = &&op_test;
+        dispatch_table[OP_WHILE] = &&op_test;
+        dispatch_table[OP_EIF] = &&op_test;
+        dispatch_table[OP_JUMP] = &&op_jump;
+        dispatch_table[OP_FOR_RANGE] = &&op_for_range;
+        dispatch_table[OP_POP] = &&op_pop;
+        dispatch_table[OP_IMM] = &&op_imm;
+        dispatch_table[OP_MAP_CREATE] = &&op_map_create;
+        dispatch_table[OP_MAP_INSERT] = &&op_map_insert;
+        dispatch_table[OP_MAKE_EMPTY_LIST] = &&op_make_empty_list;
+        dispatch_table[OP_LIST_ADD_TAIL] = &&op_list_add_tail;
+        dispatch_table[OP_LIST_APPEND] = &&op_list_append;
+        dispatch_table[OP_INDEXSET] = &&op_indexset;
+        dispatch_table[OP_MAKE_SINGLETON_LIST] = &&op_make_singleton_list;
+        dispatch_table[OP_CHECK_LIST_FOR_SPLICE] = &&op_check_list_for_splice;
+        dispatch_table[OP_PUT_TEMP] = &&op_put_temp;
+        dispatch_table[OP_PUSH_TEMP] = &&op_push_temp;
+        dispatch_table[OP_EQ] = &&op_eq;
+        dispatch_table[OP_NE] = &&op_eq;
+        dispatch_table[OP_GT] = &&op_compare;
+        dispatch_table[OP_LT] = &&op_compare;
+        dispatch_table[OP_GE] = &&op_compare;
+        dispatch_table[OP_LE] = &&op_compare;
+        dispatch_table[OP_IN] = &&op_in;
+        dispatch_table[OP_MULT] = &&op_arith;
+        dispatch_table[OP_MINUS] = &&op_arith;
+        dispatch_table[OP_DIV] = &&op_arith;
+        dispatch_table[OP_MOD] = &&op_arith;
+        dispatch_table[OP_ADD] = &&op_add;
+        dispatch_table[OP_AND] = &&op_and_or;
+        dispatch_table[OP_OR] = &&op_and_or;
+        dispatch_table[OP_NOT] = &&op_not;
+        dispatch_table[OP_UNARY_MINUS] = &&op_unary_minus;
+        dispatch_table[OP_REF] = &&op_ref;
+        dispatch_table[OP_PUSH_REF] = &&op_push_ref;
+        dispatch_table[OP_RANGE_REF] = &&op_range_ref;
+        dispatch_table[OP_G_PUT] = &&op_g_put;
+        dispatch_table[OP_G_PUSH] = &&op_g_push;
+        dispatch_table[OP_GET_PROP] = &&op_get_prop;
+        dispatch_table[OP_PUSH_GET_PROP] = &&op_push_get_prop;
+        dispatch_table[OP_PUT_PROP] = &&op_put_prop;
+        dispatch_table[OP_FORK] = &&op_fork;
+        dispatch_table[OP_FORK_WITH_ID] = &&op_fork;
+        dispatch_table[OP_CALL_VERB] = &&op_call_verb;
+        dispatch_table[OP_RETURN] = &&op_return;
+        dispatch_table[OP_RETURN0] = &&op_return;
+        dispatch_table[OP_DONE] = &&op_return;
+        dispatch_table[OP_BI_FUNC_CALL] = &&op_bi_func_call;
+        dispatch_table[OP_EXTENDED] = &&op_extended;
+        for (i = 0; i < NUM_READY_VARS; i++) {
+            dispatch_table[OP_PUSH + i] = &&op_push_n;
+            dispatch_table[OP_PUT + i] = &&op_put_n;
+#ifdef BYTECODE_REDUCE_REF
+            dispatch_table[OP_PUSH_CLEAR + i] = &&op_push_clear_n;
+#endif
+        }
+        /* optimized numbers are handled by the default case */
+
+        dispatch_table_ready = true;
+    }
+#endif              /* USE_COMPUTED_GOTO */
+
     LOAD_STATE_VARIABLES();
 
     if (raise) {
@@ -971,27 +1082,17 @@ run(char raise, enum error resumption_error, Var * result)
     }
     for (;;) {
 next_opcode:
-        error_bv = bv;
-        op = (Opcode)(*bv++);
-
-        if (COUNT_TICK(op)) {
-            if (--ticks_remaining <= 0) {
-                STORE_STATE_VARIABLES();
-                abort_task(ABORT_TICKS);
-                return OUTCOME_ABORTED;
-            }
-            if (task_timed_out) {
-                STORE_STATE_VARIABLES();
-                abort_task(ABORT_SECONDS);
-                return OUTCOME_ABORTED;
-            }
-        }
+        FETCH_OPCODE();
+#ifdef USE_COMPUTED_GOTO
+        goto *dispatch_table[op];
+#endif
         switch (op) {
 
             case OP_IF_QUES:
             case OP_IF:
             case OP_WHILE:
             case OP_EIF:
+            TARGET(op_test)
 do_test:
                 {
                     Var cond;
@@ -1006,16 +1107,18 @@ do_test:
                     }
                     free_var(cond);
                 }
-                break;
+                DISPATCH();
 
             case OP_JUMP:
+            TARGET(op_jump)
             {
                 unsigned lab = READ_BYTES(bv, bc.numbytes_label);
                 JUMP(lab);
             }
-            break;
+            DISPATCH();
 
             case OP_FOR_RANGE:
+            TARGET(op_for_range)
             {
                 unsigned id = READ_BYTES(bv, bc.numbytes_var_name);
                 unsigned lab = READ_BYTES(bv, bc.numbytes_label);
@@ -1060,13 +1163,15 @@ do_test:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_POP:
+            TARGET(op_pop)
                 free_var(POP());
-                break;
+                DISPATCH();
 
             case OP_IMM:
+            TARGET(op_imm)
             {
                 int slot;
 
@@ -1081,18 +1186,20 @@ do_test:
                 slot = READ_BYTES(bv, bc.numbytes_literal);
                 PUSH_REF(RUN_ACTIV.prog->literals[slot]);
             }
-            break;
+            DISPATCH();
 
             case OP_MAP_CREATE:
+            TARGET(op_map_create)
             {
                 Var map;
 
                 map = new_map();
                 PUSH(map);
             }
-            break;
+            DISPATCH();
 
             case OP_MAP_INSERT:
+            TARGET(op_map_insert)
             {
                 Var r, map, key, value;
                 key = POP(); /* any except list or map */
@@ -1113,18 +1220,20 @@ do_test:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_MAKE_EMPTY_LIST:
+            TARGET(op_make_empty_list)
             {
                 Var list;
 
                 list = new_list(0);
                 PUSH(list);
             }
-            break;
+            DISPATCH();
 
             case OP_LIST_ADD_TAIL:
+            TARGET(op_list_add_tail)
             {
                 Var r, tail, list;
 
@@ -1144,9 +1253,10 @@ do_test:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_LIST_APPEND:
+            TARGET(op_list_append)
             {
                 Var r, tail, list;
 
@@ -1166,13 +1276,14 @@ do_test:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             /* This opcode will not increase the length of a string
              * but it may increase the size of a list or map, thus the
              * check.
              */
             case OP_INDEXSET:
+            TARGET(op_indexset)
             {
                 Var value, index, list;
 
@@ -1262,9 +1373,10 @@ do_test:
                         PUSH(list);
                     }
             }
-            break;
+            DISPATCH();
 
             case OP_MAKE_SINGLETON_LIST:
+            TARGET(op_make_singleton_list)
             {
                 Var list;
 
@@ -1272,28 +1384,32 @@ do_test:
                 list.v.list[1] = POP();
                 PUSH(list);
             }
-            break;
+            DISPATCH();
 
             case OP_CHECK_LIST_FOR_SPLICE:
+            TARGET(op_check_list_for_splice)
                 if (TOP_RT_VALUE.type != TYPE_LIST) {
                     var_type rt_value_type = TOP_RT_VALUE.type;
                     free_var(POP());
                     PUSH_TYPE_MISMATCH(1, rt_value_type, TYPE_LIST);
                 }
                 /* no op if top-rt-stack is a list */
-                break;
+                DISPATCH();
 
             case OP_PUT_TEMP:
+            TARGET(op_put_temp)
                 RUN_ACTIV.temp = var_ref(TOP_RT_VALUE);
-                break;
+                DISPATCH();
 
             case OP_PUSH_TEMP:
+            TARGET(op_push_temp)
                 PUSH(RUN_ACTIV.temp);
                 RUN_ACTIV.temp.type = TYPE_NONE;
-                break;
+                DISPATCH();
 
             case OP_EQ:
             case OP_NE:
+            TARGET(op_eq)
             {
                 Var rhs, lhs, ans;
 
@@ -1307,12 +1423,13 @@ do_test:
                 free_var(rhs);
                 free_var(lhs);
             }
-            break;
+            DISPATCH();
 
             case OP_GT:
             case OP_LT:
             case OP_GE:
             case OP_LE:
+            TARGET(op_compare)
             {
                 Var rhs, lhs, ans;
                 int comparison;
@@ -1378,9 +1495,10 @@ finish_comparison:
                     free_var(lhs);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_IN:
+            TARGET(op_in)
             {
                 Var lhs, rhs, ans;
 
@@ -1406,12 +1524,13 @@ finish_comparison:
                     free_var(lhs);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_MULT:
             case OP_MINUS:
             case OP_DIV:
             case OP_MOD:
+            TARGET(op_arith)
             {
                 Var lhs, rhs, ans;
                 var_type lhs_type, rhs_type;
@@ -1461,9 +1580,10 @@ finish_comparison:
                     PUSH(ans);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_ADD:
+            TARGET(op_add)
             {
                 Var rhs, lhs, ans;
                 var_type lhs_type, rhs_type;
@@ -1482,6 +1602,11 @@ finish_comparison:
                     if (server_int_option_cached(SVO_MAX_STRING_CONCAT) < flen) {
                         ans.type = TYPE_ERR;
                         ans.v.err = E_QUOTA;
+                    } else if (var_refcount(lhs) == 1) {
+                        /* `s = s + ...': nobody else can see `lhs' */
+                        ans.type = TYPE_STR;
+                        ans.v.str = str_append(lhs.v.str, llen, rhs.v.str, flen - llen);
+                        lhs = var_ref(ans);
                     } else {
                         str = (char *)mymalloc(flen + 1, M_STRING);
                         strcpy(str, lhs.v.str);
@@ -1530,10 +1655,11 @@ finish_comparison:
                     PUSH(ans);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_AND:
             case OP_OR:
+            TARGET(op_and_or)
             {
                 Var lhs;
                 unsigned lab = READ_BYTES(bv, bc.numbytes_label);
@@ -1546,9 +1672,10 @@ finish_comparison:
                     free_var(POP());
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_NOT:
+            TARGET(op_not)
             {
                 Var arg, ans;
 
@@ -1558,9 +1685,10 @@ finish_comparison:
                 PUSH(ans);
                 free_var(arg);
             }
-            break;
+            DISPATCH();
 
             case OP_UNARY_MINUS:
+            TARGET(op_unary_minus)
             {
                 Var arg, ans;
                 var_type arg_type;
@@ -1582,9 +1710,10 @@ finish_comparison:
                 PUSH(ans);
                 free_var(arg);
             }
-            break;
+            DISPATCH();
 
             case OP_REF:
+            TARGET(op_ref)
             {
                 Var index, list;
 
@@ -1663,9 +1792,10 @@ finish_comparison:
                         }
                     }
             }
-            break;
+            DISPATCH();
 
             case OP_PUSH_REF:
+            TARGET(op_push_ref)
             {
                 /* This is about the sketchiest manoeuvre I can
                  * imagine.  The goal is to mutate a nested list/map
@@ -1696,7 +1826,7 @@ finish_comparison:
                     const rbnode *node;
                     if (index.is_collection() && TYPE_ANON != index.type) {
                         PUSH_TYPE_MISMATCH(8, index.type, TYPE_STR, TYPE_INT, TYPE_OBJ, TYPE_ERR, TYPE_FLOAT, TYPE_ANON, TYPE_WAIF, TYPE_BOOL);
-                    } else if (!(node = maplookup(list, index, &value, 0))) {
+                    } else if (!(node = maplookup_owned(list, index, &value))) {
                         PUSH_ERROR(E_RANGE);
                     } else {
                         PUSH(value);
@@ -1716,9 +1846,10 @@ finish_comparison:
                     PUSH_TYPE_MISMATCH(2, list.type, TYPE_LIST, TYPE_MAP);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_RANGE_REF:
+            TARGET(op_range_ref)
             {
                 Var base, from, to;
 
@@ -1793,17 +1924,19 @@ finish_comparison:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_G_PUT:
+            TARGET(op_g_put)
             {
                 unsigned id = READ_BYTES(bv, bc.numbytes_var_name);
                 free_var(RUN_ACTIV.rt_env[id]);
                 RUN_ACTIV.rt_env[id] = var_ref(TOP_RT_VALUE);
             }
-            break;
+            DISPATCH();
 
             case OP_G_PUSH:
+            TARGET(op_g_push)
             {
                 Var value;
 
@@ -1817,9 +1950,10 @@ finish_comparison:
                 else
                     PUSH_REF(value);
             }
-            break;
+            DISPATCH();
 
             case OP_GET_PROP:
+            TARGET(op_get_prop)
             {
                 Var propname, obj, prop;
 
@@ -1855,7 +1989,8 @@ finish_comparison:
                     db_prop_handle h;
                     int built_in;
 
-                    h = db_find_property(obj, propname.v.str, &prop);
+                    h = db_find_property_cached(obj, propname.v.str, &prop,
+                                                program_prop_cache(RUN_ACTIV.prog, error_bv));
                     built_in = db_is_property_built_in(h);
 
                     if (!h.ptr) {
@@ -1875,9 +2010,10 @@ finish_comparison:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_PUSH_GET_PROP:
+            TARGET(op_push_get_prop)
             {
                 Var propname, obj, prop;
 
@@ -1905,7 +2041,8 @@ finish_comparison:
                     db_prop_handle h;
                     int built_in;
 
-                    h = db_find_property(obj, propname.v.str, &prop);
+                    h = db_find_property_cached(obj, propname.v.str, &prop,
+                                                program_prop_cache(RUN_ACTIV.prog, error_bv));
                     built_in = db_is_property_built_in(h);
                     if (!h.ptr) {
                         var_ref(propname);
@@ -1921,9 +2058,10 @@ finish_comparison:
                         PUSH_REF(prop);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_PUT_PROP:
+            TARGET(op_put_prop)
             {
                 Var obj, propname, rhs;
 
@@ -2046,10 +2184,11 @@ finish_comparison:
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_FORK:
             case OP_FORK_WITH_ID:
+            TARGET(op_fork)
             {
                 Var time;
                 unsigned id = 0, f_index;
@@ -2077,9 +2216,10 @@ finish_comparison:
                         RAISE_ERROR(e);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_CALL_VERB:
+            TARGET(op_call_verb)
             {
                 enum error err;
                 Var args, verb, obj;
@@ -2137,7 +2277,8 @@ else if (obj.type == TYPE_##t1) {           \
 
                     if (obj.is_object() || recv != NOTHING) {
                         STORE_STATE_VARIABLES();
-                        err = call_verb2(recv, verb.v.str, obj, args, 0, DEFAULT_THREAD_MODE);
+                        err = call_verb2(recv, verb.v.str, obj, args, 0, DEFAULT_THREAD_MODE,
+                                         program_verb_cache(RUN_ACTIV.prog, error_bv));
                         /* if there is no error, RUN_ACTIV is now the CALLEE's.
                            args will be consumed in the new rt_env */
                         /* if there is an error, then RUN_ACTIV is unchanged, and
@@ -2163,11 +2304,12 @@ else if (obj.type == TYPE_##t1) {           \
                     free_var(obj);
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_RETURN:
             case OP_RETURN0:
             case OP_DONE:
+            TARGET(op_return)
             {
                 Var ret_val;
 
@@ -2186,9 +2328,10 @@ else if (obj.type == TYPE_##t1) {           \
                 }
                 LOAD_STATE_VARIABLES();
             }
-            break;
+            DISPATCH();
 
             case OP_BI_FUNC_CALL:
+            TARGET(op_bi_func_call)
             {
                 unsigned func_id;
                 Var args;
@@ -2245,9 +2388,10 @@ else if (obj.type == TYPE_##t1) {           \
                     }
                 }
             }
-            break;
+            DISPATCH();
 
             case OP_EXTENDED:
+            TARGET(op_extended)
             {
                 enum Extended_Opcode eop = (Extended_Opcode)(*bv);
                 bv++;
@@ -2846,7 +2990,7 @@ else if (obj.type == TYPE_##t1) {           \
                         panic_moo("Unknown extended opcode!");
                 }
             }
-            break;
+            DISPATCH();
 
                 /* These opcodes account for about 20% of all opcodes executed, so
                    let's split out the case stmt so the compiler can help us out.
@@ -2889,6 +3033,7 @@ else if (obj.type == TYPE_##t1) {           \
             case OP_PUSH + 29:
             case OP_PUSH + 30:
             case OP_PUSH + 31:
+            TARGET(op_push_n)
             {
                 Var value;
                 value = RUN_ACTIV.rt_env[PUSH_n_INDEX(op)];
@@ -2900,7 +3045,7 @@ else if (obj.type == TYPE_##t1) {           \
                 } else
                     PUSH_REF(value);
             }
-            break;
+            DISPATCH();
 
 #ifdef BYTECODE_REDUCE_REF
             case OP_PUSH_CLEAR:
@@ -2935,6 +3080,7 @@ else if (obj.type == TYPE_##t1) {           \
             case OP_PUSH_CLEAR + 29:
             case OP_PUSH_CLEAR + 30:
             case OP_PUSH_CLEAR + 31:
+            TARGET(op_push_clear_n)
             {
                 Var *vp;
                 vp = &RUN_ACTIV.rt_env[PUSH_CLEAR_n_INDEX(op)];
@@ -2947,7 +3093,7 @@ else if (obj.type == TYPE_##t1) {           \
                     vp->type = TYPE_NONE;
                 }
             }
-            break;
+            DISPATCH();
 #endif              /* BYTECODE_REDUCE_REF */
 
             case OP_PUT:
@@ -2982,6 +3128,7 @@ else if (obj.type == TYPE_##t1) {           \
             case OP_PUT + 29:
             case OP_PUT + 30:
             case OP_PUT + 31:
+            TARGET(op_put_n)
             {
                 Var *varp = &RUN_ACTIV.rt_env[PUT_n_INDEX(op)];
                 free_var(*varp);
@@ -2991,9 +3138,10 @@ else if (obj.type == TYPE_##t1) {           \
                 } else
                     *varp = var_ref(TOP_RT_VALUE);
             }
-            break;
+            DISPATCH();
 
             default:
+            TARGET(op_default)
                 if (IS_OPTIM_NUM_OPCODE(op)) {
                     Var value;
                     value.type = TYPE_INT;
@@ -3001,7 +3149,7 @@ else if (obj.type == TYPE_##t1) {           \
                     PUSH(value);
                 } else
                     panic_moo("Unknown opcode!");
-                break;
+                DISPATCH();
         }
     }
 }
@@ -183,6 +183,12 @@ name_func_by_num(unsigned n)
         return bf_table[n].name;
 }
 
+unsigned
+num_builtin_functions(void)
+{
+    return top_bf_table;
+}
+
 unsigned
 number_func_by_name(const char *name)
 {				/* used by parser only */
@@ -19,4 +19,21 @@
 #include "program.h"
 #include "version.h"
 
+/* Bump whenever generate_code() changes the bytecode it emits for the same
+ * source; it is folded into the fingerprint that guards bytecode saved in
+ * the database.
+ */
+#define CODE_GEN_REVISION 1
+
 extern Program *generate_code(Stmt *, DB_Version);
+
+extern void set_literal_interning(int);
+				/* Whether string literals compiled on the
+				 * calling thread are interned; otherwise
+				 * they are just copied.  On by default.
+				 */
+extern void intern_program_literals(Program *);
+				/* Interns the string literals of a program
+				 * compiled or read without interning.  Only
+				 * on the main thread.
+				 */
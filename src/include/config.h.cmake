@@ -85,6 +85,7 @@
 #cmakedefine MYSQL_FOUND
 #cmakedefine SQL_FOUND
 #cmakedefine JEMALLOC_FOUND
+#cmakedefine ZLIB_FOUND
 
 #ifndef OPENSSL_FOUND
  #undef USE_TLS
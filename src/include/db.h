@@ -83,6 +83,25 @@ extern int db_flush(enum db_flush_type);
 				 * argument.  Returns true on success.
 				 */
 
+extern int db_checkpoint_finished(void);
+				/* With THREADED_CHECKPOINTS, a checkpoint
+				 * started by db_flush(FLUSH_ALL_NOW) goes on
+				 * being written after it returns.  Returns 0
+				 * while it is, and then (once) 2 if it
+				 * succeeded or 1 if it failed.  Always 0
+				 * otherwise.
+				 */
+
+extern Var db_checkpoint_stats(void);
+				/* Returns a map describing the last checkpoint
+				 * to finish: when it started and how, whether
+				 * it succeeded, how long it took and how long
+				 * the server stood still for it, the seconds
+				 * spent in each phase, the bytes written and
+				 * the memory used by the process writing it.
+				 * Empty if there hasn't been one.
+				 */
+
 extern Num db_disk_size(void);
 				/* Return the total size, in bytes, of the most
 				 * recent full representation of the database
@@ -91,6 +110,13 @@ extern Num db_disk_size(void);
 				 * representation is currently available.
 				 */
 
+extern int db_set_dump_format(const char *format);
+				/* Makes every later dump use FORMAT ("text",
+				 * "binary" or "compressed"), whatever
+				 * $server_options.dump_format says.  Returns
+				 * false if FORMAT isn't one of those.
+				 */
+
 extern void db_shutdown(void);
 				/* Shut down the database module, flushing all
 				 * pending database changes to disk and only
@@ -395,6 +421,7 @@ typedef struct {
     enum bi_prop built_in;	/* true iff property is a built-in one */
     void *definer;		/* null iff property is a built-in one */
     void *ptr;			/* null iff property not found */
+    void *object;		/* object holding the value */
 } db_prop_handle;
 
 extern db_prop_handle db_find_property(Var obj, const char *name,
@@ -424,6 +451,39 @@ extern db_prop_handle db_find_property(Var obj, const char *name,
 				 * leave the handle intact.
 				 */
 
+typedef struct db_prop_cache {
+    const void *site;		/* identifies the caller's lookup site */
+    const char *name;		/* null iff the entry is empty */
+    unsigned int layout;	/* property layout of the last object */
+    unsigned int generation;
+    enum bi_prop built_in;
+    int offset;			/* slot in the object's property values */
+    int index;			/* position among the definer's propdefs */
+    void *definer;
+} db_prop_cache;
+
+extern db_prop_handle db_find_property_cached(Var obj, const char *name,
+					      Var * value,
+					      db_prop_cache *cache);
+				/* Behaves exactly like `db_find_property()',
+				 * but first consults (and afterwards updates)
+				 * the given cache entry.  A hit requires the
+				 * identical `name' string and an object whose
+				 * property layout matches the one recorded.
+				 * Objects that define no properties of their
+				 * own share their parent's layout, so a site
+				 * that reads from instances of one class
+				 * skips the walk up the ancestors entirely.
+				 * The entry holds a reference to `name', so
+				 * it must be a string value; its hash is
+				 * remembered along with it.
+				 */
+
+extern void db_clear_prop_cache(db_prop_cache *cache);
+				/* Releases the name held by the entry and
+				 * marks it empty.
+				 */
+
 extern Var db_property_value(db_prop_handle);
 extern void db_set_property_value(db_prop_handle, Var);
 				/* For non-built-in properties, these functions
@@ -587,6 +647,40 @@ extern db_verb_handle db_find_callable_verb(Var recv, const char *verb);
 				 * leave the handle intact.
 				 */
 
+#define VERB_CACHE_WAYS 4
+
+typedef struct db_verb_cache {
+    const void *site;		/* identifies the caller's call site */
+    const char *name;		/* null iff the entry is empty */
+    int next;			/* way to replace on the next miss */
+    struct {
+	Objid recv;
+	unsigned int stamp;	/* the receiver's verb lookup stamp */
+	void *definer;
+	void *verbdef;
+    } ways[VERB_CACHE_WAYS];
+} db_verb_cache;
+
+extern db_verb_handle db_find_callable_verb_cached(Objid recv,
+						   const char *verb,
+						   db_verb_cache *cache);
+				/* Behaves exactly like
+				 * `db_find_callable_verb()' on a valid,
+				 * permanent RECV, but first consults the
+				 * given polymorphic cache.  Hits require the
+				 * identical VERB string, one of the last
+				 * VERB_CACHE_WAYS receivers, and no change to
+				 * verb lookup on that receiver or its
+				 * ancestors since the entry was filled.
+				 * Failed lookups are not cached.  The entry
+				 * holds a reference to VERB.
+				 */
+
+extern void db_clear_verb_cache(db_verb_cache *cache);
+				/* Releases the name held by the entry and
+				 * marks it empty.
+				 */
+
 extern db_verb_handle db_find_defined_verb(Var obj, const char *verb,
 					   int allow_numbers);
 				/* Returns a handle on the first verb found
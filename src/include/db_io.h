@@ -50,6 +50,12 @@ extern const char *dbio_read_string(void);
 				 * str_dup() it if it is to persist.
 				 */
 
+extern int dbio_read_bytes(void *, size_t);
+				/* Reads what `dbio_write_bytes()' wrote,
+				 * which must be exactly this many bytes.
+				 * Returns false if it isn't.
+				 */
+
 extern const char *dbio_read_string_intern(void);
 				/* The returned string is duplicated
 				 * and possibly interned in a db-load
@@ -72,6 +78,21 @@ extern Program *dbio_read_program(DB_Version version,
 				 * be the required string.
 				 */
 
+extern const char *dbio_read_program_text(void);
+				/* Reads the text of a program, up to its
+				 * end marker, without parsing it.  Returns
+				 * null on a premature EOF.
+				 */
+
+extern Program *dbio_parse_program_text(DB_Version version,
+					const char *text,
+					const char *(*fmtr) (void *),
+					void *data);
+				/* Like `dbio_read_program()', but parses
+				 * TEXT as previously returned by
+				 * `dbio_read_program_text()'.
+				 */
+
 
 /*********** Output ***********/
 
@@ -95,7 +116,29 @@ extern void dbio_write_string(const char *);
 				 * newline characters.
 				 */
 
+extern void dbio_write_bytes(const void *, size_t);
+				/* Writes that many raw bytes, which may be
+				 * anything; even in a text database they
+				 * are not escaped.  The reader has to know
+				 * how many there are, so write the count
+				 * first.
+				 */
+
 extern void dbio_write_var(Var);
 
 extern void dbio_write_program(Program *);
+extern void dbio_write_program_text(const char *);
+
+extern unsigned dbio_bytecode_fingerprint(void);
+				/* Identifies the compiler; compiled programs
+				 * are only portable between servers that
+				 * agree on it.
+				 */
+extern void dbio_write_program_bytecode(Program *);
+extern Program *dbio_read_program_bytecode(void);
+				/* Returns null if the compiled form is
+				 * malformed or any operand is out of
+				 * range for its program.  Interns the
+				 * string literals, so main thread only.
+				 */
 extern void dbio_write_forked_program(Program * prog, int f_index);
@@ -32,6 +32,12 @@ typedef struct Verbdef Verbdef;
 struct Verbdef {
     const char *name;
     Program *program;
+    const char *source;		/* uncompiled program text, if `program'
+				 * hasn't been built yet */
+    bool unparsable;		/* `source' failed to compile; don't try
+				 * again */
+    bool edited;		/* reprogrammed or moved since the journal
+				 * last wrote it */
     Objid owner;
     short perms;
     short prep;
@@ -84,36 +90,70 @@ typedef struct Object {
      */
     unsigned int nonce;
 
+    /* Changes whenever verb lookup starting at this object could give
+     * a different answer (see `db_priv_affected_callable_verb_lookup').
+     */
+    unsigned int verb_stamp;
+
+    /* Name-to-slot index over every property this object defines or
+     * inherits, built on demand.  Objects that share this one's layout
+     * (descendants defining no properties, with one parent) use it
+     * too.  Only trusted while its recorded nonce matches the object's
+     * (see db_properties.cc).
+     */
+    struct Propindex *prop_index;
+
+    /* Checkpoint epoch of the last change to anything saved with this
+     * object (see `dbpriv_mark_dirty').
+     */
+    unsigned int dirty;
+
     void *waif_propdefs;
+
+    /* Hash indexes over `contents' and `children' once they grow
+     * large, while they are the only complete record of them (see
+     * db_objects.cc); null otherwise.
+     */
+    struct Objset *contents_set;
+    struct Objset *children_set;
+
+    /* With USE_ANCESTOR_CACHE, the list `db_ancestors()' last computed
+     * for this object, or `none' if it has to be computed again.
+     */
+    Var ancestors;
 } Object;
 
 /*
  * `parents' can be #-1 (NOTHING), a valid object number, or a list of
  * valid object numbers.  `location' can be #-1 or a valid object
  * number.  `children' and `contents' must be a list of valid object
- * numbers.
+ * numbers, and should only be read through `dbpriv_object_children()'
+ * and `dbpriv_object_contents()'.
  */
 
 /*********** Verb cache support ***********/
 
 #define VERB_CACHE 1
 
-#ifdef VERB_CACHE
-
 /* Whenever anything is modified that could influence callable verb
- * lookup, this function must be called.
+ * lookup, this function must be called with the object whose verbs or
+ * parentage changed.  Only lookups whose path passes through that
+ * object (that is, lookups starting at it or at one of its
+ * descendants) are invalidated: each object carries a `verb_stamp'
+ * that cached lookups keyed on it are checked against, and this gives
+ * the object and all of its descendants fresh stamps.
  */
+extern void db_priv_affected_callable_verb_lookup(Var obj);
 
-#ifdef RONG
-#define db_priv_affected_callable_verb_lookup() (db_verb_generation++)
-                                 /* The choice of a new generation. */
-extern unsigned int db_verb_generation;
-#endif
-
-extern void db_priv_affected_callable_verb_lookup(void);
+extern void dbpriv_assign_verb_stamp(Object *);
 
-#else /* no cache */
-#define db_priv_affected_callable_verb_lookup()
+/* Drops every cached lookup keyed on `o', which is about to be freed
+ * (or moved).
+ */
+#ifdef VERB_CACHE
+extern void dbpriv_forget_cached_verbs(Object *o);
+#else
+#define dbpriv_forget_cached_verbs(o)
 #endif
 
 /*********** Objects ***********/
@@ -123,6 +163,23 @@ extern void db_write_anonymous(Var);
 
 extern void dbpriv_assign_nonce(Object *);
 
+/* Incremental checkpoints only write the objects that changed since the
+ * last full dump.  Every mutator that changes something saved with an
+ * object must call `dbpriv_mark_dirty' on it; `dbpriv_next_epoch' is
+ * called as each checkpoint snapshot is taken and returns the epoch it
+ * covers, so an object is in a later snapshot's delta iff its `dirty'
+ * epoch is greater than the epoch of the base snapshot.
+ */
+extern void dbpriv_mark_dirty(Object *);
+extern unsigned int dbpriv_next_epoch(void);
+
+extern void dbpriv_track_changes(int);
+extern Var dbpriv_take_changes(void);
+				/* While tracking is on, returns (and forgets)
+				 * the sorted numbers of the permanent objects
+				 * changed or recycled since the last call.
+				 */
+
 extern Objid dbpriv_object_owner(Object *);
 extern void dbpriv_set_object_owner(Object *, Objid owner);
 
@@ -170,6 +227,24 @@ extern void dbpriv_new_recycled_object(void);
 				 * using up the next available object number.
 				 */
 
+extern Object *dbpriv_replace_object(Objid);
+				/* Frees whatever is at `oid' (extending the
+				 * object table if needed) and puts a fresh
+				 * object there, with none of its fields
+				 * filled in other than `id'.  Used when
+				 * applying a checkpoint delta.
+				 */
+extern void dbpriv_forget_object(Objid);
+				/* Frees whatever is at `oid' without any of
+				 * the hierarchy checks `db_destroy_object'
+				 * makes.  Used when applying a checkpoint
+				 * delta.
+				 */
+extern void dbpriv_set_last_used_objid(Objid);
+				/* Frees every object above `oid' and makes
+				 * it the last used object number.
+				 */
+
 extern Object *dbpriv_find_object(Objid);
 				/* Returns 0 if given object is not valid.
 				 */
@@ -180,6 +255,8 @@ extern void dbpriv_after_load(void);
 
 extern Propdef dbpriv_new_propdef(const char *);
 
+extern void dbpriv_free_prop_index(Object *);
+
 extern int dbpriv_check_properties_for_chparent(Var obj,
 						Var parents,
 						Var anon_kids);
@@ -203,6 +280,18 @@ extern void dbpriv_fix_properties_after_chparent(Var obj,
 
 /*********** Verbs ***********/
 
+extern void dbpriv_set_verb_source(db_verb_handle, const char *source);
+				/* Gives the verb SOURCE (consumed) as its
+				 * program text, to be compiled by
+				 * `db_verb_program()' on first use.
+				 */
+
+extern void dbpriv_mark_verbs_edited(Object *);
+				/* Every verb on the object has moved, so
+				 * the journal must write them all out
+				 * again.
+				 */
+
 extern void dbpriv_build_prep_table(void);
 				/* Should be called once near the beginning of
 				 * the world, to initialize the
@@ -228,9 +317,95 @@ public:
 				 * running out of disk space for the dump).
 				 */
 
+class dbpriv_dbio_shared_value: public std::exception
+{
+public:
+
+    dbpriv_dbio_shared_value() throw() {}
+
+    ~dbpriv_dbio_shared_value() throw() override {}
+
+    const char* what() const throw() override {
+	return "dbio refused a shared value";
+    }
+};
+
+				/* Raised by DBIO when asked to write an
+				 * anonymous object or a WAIF while
+				 * `dbpriv_refuse_shared_values' is on.
+				 * Those keep their identity only within a
+				 * single file, so a checkpoint delta can't
+				 * hold them.
+				 */
+
 extern void dbpriv_set_dbio_input(FILE *);
+				/* Reads from a regular file are done from
+				 * a mapping of it, after which the FILE's
+				 * own position is meaningless; use
+				 * `dbpriv_dbio_input_offset()' instead.
+				 * Passing null releases the mapping.
+				 */
+extern long dbpriv_dbio_input_offset(void);
+
+extern long dbpriv_dbio_input_mark(void);
+extern void dbpriv_set_dbio_input_range(long start, long end);
+				/* The mark is the input offset, or -1 if
+				 * reading can't be resumed from it (the
+				 * input isn't mapped, is compressed, or
+				 * has text left over from a binary token).
+				 * Any thread may then read the input
+				 * between two marks, or from a mark to the
+				 * end if `end' is -1; each thread has its
+				 * own position.
+				 */
+extern void dbpriv_set_dbio_interning(int);
+				/* Whether dbio_read_string_intern() on the
+				 * calling thread interns; otherwise it
+				 * just copies.  On by default.
+				 */
+extern void dbpriv_release_dbio_buffers(void);
+				/* Frees the calling thread's read buffers,
+				 * before it exits.
+				 */
+extern void dbpriv_skip_dbio_string(void);
+extern int dbpriv_skip_dbio_var(void);
+				/* Read past a value without building it.
+				 * The latter returns false if the value
+				 * holds anonymous objects or WAIFs, whose
+				 * reading has to be done in order.
+				 */
+
 extern void dbpriv_set_dbio_output(FILE *);
 
+enum dbio_format {
+    DBIO_TEXT, DBIO_BINARY, DBIO_COMPRESSED
+};
+
+extern int dbpriv_set_dbio_output_format(enum dbio_format);
+				/* Call right after dbpriv_set_dbio_output()
+				 * to write in a format other than text.
+				 * Input in any format is recognized by
+				 * dbpriv_set_dbio_input().  Returns false on
+				 * failure.
+				 */
+extern void dbpriv_set_dbio_output_encoding(enum dbio_format);
+extern void dbpriv_write_dbio_encoded(const char *, size_t);
+				/* Output encoded for the given format, but
+				 * without its leading line or compression,
+				 * can be written out later (perhaps by
+				 * another thread) as part of output in that
+				 * format with the latter.
+				 */
+extern void dbpriv_flush_dbio_output(void);
+				/* DBIO buffers its output; this passes
+				 * everything written so far on to the
+				 * output FILE, raising dbpriv_dbio_failed
+				 * on error.  Call it once everything has
+				 * been written, before flushing or closing
+				 * that FILE.
+				 */
+extern void dbpriv_refuse_shared_values(int);
+
 /****/
 
 static inline Object *
@@ -85,9 +85,11 @@ typedef vmstruct *vm;
 extern enum error call_verb(Objid obj, const char *vname,
 			    Var _this, Var args, int do_pass);
 /* if your vname is already a moo str (via str_dup) then you can
-   use this interface instead */
+   use this interface instead; `cache', if given, is consulted for
+   ordinary (non-pass) calls on permanent objects */
 extern enum error call_verb2(Objid obj, const char *vname,
-			     Var _this, Var args, int do_pass, bool should_thread);
+			     Var _this, Var args, int do_pass, bool should_thread,
+			     db_verb_cache *cache = nullptr);
 
 extern int setup_activ_for_eval(Program * prog);
 
@@ -84,6 +84,7 @@ typedef void *(*bf_read_type) (void);
 
 extern const char *name_func_by_num(unsigned);
 extern unsigned number_func_by_name(const char *);
+extern unsigned num_builtin_functions(void);
 
 extern unsigned register_function(const char *, int, int, bf_type,...);
 extern unsigned register_function_with_read_write(const char *, int, int,
@@ -24,6 +24,7 @@
 extern Var new_list(int size);
 extern void destroy_list(Var list);
 extern Var list_dup(Var list);
+extern Var list_compact(Var list);
 
 extern Var listappend(Var list, Var value);
 extern Var listinsert(Var list, Var value, int pos);
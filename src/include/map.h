@@ -33,15 +33,25 @@
 #define MAP_H
 #define HEIGHT_LIMIT 64     /* Tallest allowable tree */
 
+/* Trees share the nodes they have in common: copying a map only
+ * copies its root pointer, and changing it copies just the nodes on
+ * the way to the change (see `own()' in map.cc).  Nothing outside of
+ * map.cc may change a node in place except through a node returned by
+ * `maplookup_owned()'.
+ */
 struct rbtree {
     rbnode *root;       /* Top of the tree */
     size_t size;        /* Number of items */
+#ifdef ENABLE_GC
+    int traced;         /* May hold values the cycle collector visits */
+#endif
 };
 
 struct rbnode {
     Var key;
     Var value;
     int red;            /* Color (1=red, 0=black) */
+    std::atomic<uint32_t> refs; /* Links to this node from trees and nodes */
     rbnode *link[2];        /* Left (0) and right (1) links */
 };
 
@@ -59,6 +69,13 @@ extern Var map_dup(Var map);
 
 extern Var mapinsert(Var map, Var key, Var value);
 extern const rbnode *maplookup(Var map, Var key, Var *value, int case_matters);
+extern const rbnode *maplookup_owned(Var map, Var key, Var *value);
+				/* Like maplookup(), but first gives MAP
+				 * (which must be referenced only once)
+				 * its own copy of every node on the way
+				 * to KEY, so that the node found can be
+				 * changed with clear_node_value().
+				 */
 extern const rbnode *mapstrlookup(Var map, const char *key, Var *value, int case_matters);
 extern int mapseek(Var map, Var key, Var *iter, int case_matters);
 extern int mapequal(Var lhs, Var rhs, int case_matters);
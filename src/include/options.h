@@ -74,6 +74,84 @@
 
 /* #define UNFORKED_CHECKPOINTS */
 
+/******************************************************************************
+ * A forked checkpointer doesn't actually save much memory: the server goes
+ * on changing reference counts all over its memory, so nearly every page ends
+ * up copied.  With THREADED_CHECKPOINTS defined, the server instead takes a
+ * snapshot of the database in memory, copying each object's record but
+ * sharing its values, and a thread writes the snapshot out while the server
+ * carries on.  Values are never changed in place while they are shared, so
+ * the snapshot only costs the object records and whatever values are
+ * changed during the checkpoint.
+ *
+ * A snapshot can't hold anonymous objects or WAIFs; a database that has any
+ * is checkpointed by forking instead.  This can't be combined with
+ * UNFORKED_CHECKPOINTS.
+ */
+
+/* #define THREADED_CHECKPOINTS */
+
+/******************************************************************************
+ * With INCREMENTAL_CHECKPOINTS defined, most checkpoints only write the
+ * objects that changed since the last full dump, to `<output-db-file>.delta'
+ * next to it; the server applies the delta on top of the database when it
+ * is next loaded, finding it as `<input-db-file>.delta' or still next to
+ * the output database, so keep the two files together when backing up the
+ * database.  A delta records the size and modification time of the dump
+ * it belongs to, and the server refuses to load if they don't match, so
+ * copy the dump with its modification time (`cp -p') or move the delta
+ * aside.  Every
+ * DEFAULT_FULL_CHECKPOINT_INTERVAL checkpoints (or as soon as the delta
+ * grows to half the size of the full dump) the whole database is written
+ * out again.  If defined in the database,
+ * $server_options.full_checkpoint_interval overrides that default.  Shutdown
+ * dumps are always full.
+ *
+ * A delta can't refer to anonymous objects or WAIFs; a checkpoint that
+ * would have to is written in full.
+ */
+
+/* #define INCREMENTAL_CHECKPOINTS */
+#define DEFAULT_FULL_CHECKPOINT_INTERVAL 12
+
+/******************************************************************************
+ * With WRITE_AHEAD_JOURNAL defined, changes made between checkpoints are
+ * also appended to journal files next to the output database
+ * (`<output-db-file>.journal.<n>') and forced to disk every
+ * DEFAULT_JOURNAL_COMMIT_INTERVAL seconds, or every
+ * $server_options.journal_commit_interval seconds if that is defined.  The
+ * forcing is done by a thread, so the server doesn't wait on the disk.  If
+ * the server crashes, the journal is replayed from next to the output
+ * database on top of the last checkpoint when it is next loaded, so about
+ * that many seconds of changes to objects are lost; tasks and connections
+ * still come from the checkpoint.  `<output-db-file>.journal' records which
+ * checkpoints the journal files follow, and they are only replayed on top
+ * of one of those; the server refuses to load any other database while
+ * journal files with changes in them are next to the output database, so
+ * move them aside first if that is what you mean to do.  Journal files are removed as checkpoints make them
+ * obsolete.
+ *
+ * The journal can't refer to anonymous objects or WAIFs; a change that
+ * would need to suspends journaling until the next checkpoint.
+ */
+
+/* #define WRITE_AHEAD_JOURNAL */
+#define DEFAULT_JOURNAL_COMMIT_INTERVAL 1
+
+/******************************************************************************
+ * DEFAULT_DUMP_FORMAT is the format the database is written in, unless
+ * $server_options.dump_format says otherwise:
+ *   "text"       -- the traditional format, one value per line
+ *   "binary"     -- the same contents with numbers and strings in binary,
+ *                   which is smaller and faster to read and write
+ *   "compressed" -- binary, and compressed with zlib (when available)
+ * The server reads a database in any of these formats, whatever this is set
+ * to.  The -D command-line option converts a database to a given format
+ * without starting the server.
+ */
+
+#define DEFAULT_DUMP_FORMAT "text"
+
 /******************************************************************************
  * If OUT_OF_BAND_PREFIX is defined as a non-empty string, then any lines of
  * input from any player that begin with that prefix will bypass both normal
@@ -317,6 +395,18 @@
 
 #define BYTECODE_REDUCE_REF /* */
 
+/******************************************************************************
+ * The interpreter normally decodes every opcode through one large switch
+ * statement.  With THREADED_DISPATCH defined, compilers that support
+ * computed gotos (GCC and Clang) will instead jump directly from the end of
+ * each opcode's handler to the handler for the next opcode, which is
+ * considerably friendlier to the CPU's branch predictor in tight loops.
+ * Other compilers silently fall back to the switch.
+ ******************************************************************************
+ */
+
+#define THREADED_DISPATCH /* */
+
 /******************************************************************************
  * The server can merge duplicate strings on load to conserve memory.  This
  * involves a rather expensive step at startup to dispose of the table used
@@ -330,6 +420,63 @@
 
 #define STRING_INTERNING /* */
 
+/******************************************************************************
+ * With LAZY_VERB_COMPILATION defined, verb programs in a database of the
+ * current version are kept as source text when the database is loaded and
+ * are only parsed and compiled the first time they are needed (to be run,
+ * listed, disassembled, etc.).  This makes startup much faster on large
+ * databases.  Verbs that are never used are written back out unchanged.
+ *
+ * The catch is that a verb whose source fails to parse no longer stops the
+ * database from loading.  It is logged once, when first used, and then
+ * behaves as an empty program (without being parsed again) until it is
+ * reprogrammed; its source is preserved.
+ ******************************************************************************
+ */
+
+#define LAZY_VERB_COMPILATION /* */
+
+/******************************************************************************
+ * Verb programs that do have to be compiled as the database is loaded (with
+ * LAZY_VERB_COMPILATION turned off, or when loading an older database
+ * version) are read first and then compiled by this many threads at once.
+ * 0 means one thread per CPU; 1 compiles each program as it is read.
+ ******************************************************************************
+ */
+
+#define VERB_COMPILATION_THREADS 0
+
+/******************************************************************************
+ * The objects in a database are also read by this many threads at once.
+ * The object section is first read through once, quickly, to find where
+ * each object starts; the objects are then decoded in parallel, and the
+ * strings in them interned afterwards.  Objects holding anonymous objects
+ * or WAIFs are still read in order, by the main thread.  Only a database
+ * that can be mapped into memory and isn't compressed is read this way.
+ * 0 means one thread per CPU; 1 reads each object as it comes.
+ ******************************************************************************
+ */
+
+#define DB_LOAD_THREADS 0
+
+/******************************************************************************
+ * With PERSISTENT_BYTECODE defined, the database file also records the
+ * compiled form (bytecode, literals, fork vectors and variable names) of every
+ * compiled verb alongside its source.  When the database is next loaded by a
+ * server whose compiler is identical (same opcodes and built-in functions, as
+ * checked by a fingerprint), verbs are loaded from their compiled form instead
+ * of being parsed; otherwise the source is compiled as usual.
+ *
+ * This only speeds up loading.  The source is still written, since it is
+ * what other servers load, so checkpoints get bigger and a little slower.
+ * The bytecode is written as raw bytes, so a text database written with
+ * this on is no longer plain text.  Databases holding compiled forms are
+ * loaded the same way whether or not this is defined.
+ ******************************************************************************
+ */
+
+/* #define PERSISTENT_BYTECODE */
+
 /******************************************************************************
  * For size operations, store the data with the type rather than recomputing.
  * String:     Store the length of the string.
@@ -339,6 +486,33 @@
 
 #define MEMO_SIZE
 
+/******************************************************************************
+ * With SLAB_ALLOCATOR defined, small allocations of the busiest kinds (short
+ * strings, small lists and maps, parse tree nodes, runtime environments, tasks
+ * and network text) are carved out of slabs by size class, from a cache kept by
+ * each thread, rather than each going to malloc().  Every allocation, slab or
+ * not, also carries a small header recording its size and Memory_Type, so that
+ * memory_usage(1) can report the live bytes and allocations of each type.
+ * Memory in a slab is reused but never given back to the system.
+ ******************************************************************************
+ */
+
+/* #define SLAB_ALLOCATOR */
+
+/******************************************************************************
+ * With BIASED_REFCOUNTS defined, the reference counts of strings, lists, maps
+ * and the like are changed with plain loads and stores rather than locked
+ * atomic instructions, as long as only one thread can see the value.  A value
+ * is marked shared (along with everything inside it) before it is handed to
+ * another thread: the arguments of a built-in function run in the background,
+ * the literals of verb programs being written out by a threaded checkpoint,
+ * and a few empty values every thread uses.  Shared values go on being
+ * counted atomically for the rest of their lives.
+ ******************************************************************************
+ */
+
+#define BIASED_REFCOUNTS /* */
+
 /******************************************************************************
  * DEFAULT_MAX_STRING_CONCAT,      if set to a positive value, is the length
  *                                 of the largest constructible string.
@@ -559,6 +733,10 @@
 #define NETWORK_PROTOCOL NP_TCP
 #endif
 
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+#define USE_COMPUTED_GOTO
+#endif
+
 #ifndef NETWORK_STYLE
 #define NETWORK_STYLE NS_BSD
 #endif
@@ -570,6 +748,10 @@
 #define OUT_OF_BAND_QUOTE_PREFIX ""
 #endif
 
+#if defined(THREADED_CHECKPOINTS) && defined(UNFORKED_CHECKPOINTS)
+#error Define at most one of THREADED_CHECKPOINTS and UNFORKED_CHECKPOINTS
+#endif
+
 #if DEFAULT_MAX_STRING_CONCAT < MIN_STRING_CONCAT_LIMIT
 #error DEFAULT_MAX_STRING_CONCAT < MIN_STRING_CONCAT_LIMIT ??
 #endif
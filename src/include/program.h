@@ -50,6 +50,14 @@ typedef struct {
     unsigned cached_lineno;
     unsigned cached_lineno_pc;
     int cached_lineno_vec;
+
+    /* Per-site lookup caches for OP_GET_PROP / OP_PUSH_GET_PROP and
+     * for OP_CALL_VERB, allocated the first time one is needed.
+     */
+    struct db_prop_cache *prop_cache;
+    unsigned prop_cache_mask;
+    struct db_verb_cache *verb_cache;
+    unsigned verb_cache_mask;
 } Program;
 
 #define MAIN_VECTOR 	-1	/* As opposed to an index into fork_vectors */
@@ -59,5 +67,7 @@ extern Program *null_program(void);
 extern Program *program_ref(Program *);
 extern int program_bytes(Program *);
 extern void free_program(Program *);
+extern struct db_prop_cache *program_prop_cache(Program *, const Byte *site);
+extern struct db_verb_cache *program_verb_cache(Program *, const Byte *site);
 
 #endif				/* !Program_H */
@@ -44,12 +44,81 @@ typedef struct var_metadata {
 #ifdef MEMO_SIZE
     uint32_t size;                      // MEMO_SIZE: strlen / list/map bytes
 #endif
+    uint32_t capacity;                  // lists: element slots allocated
+                                        // strings: bytes allocated
+#if defined(ENABLE_GC) || defined(MEMO_SIZE)
+    union {
 #ifdef ENABLE_GC
-    GC_Color color:3;
-    unsigned int buffered:1;
+        struct {                        // lists, maps, anonymous objects
+            GC_Color color:3;
+            unsigned int buffered:1;
+        };
+#endif
+#ifdef MEMO_SIZE
+        uint32_t hash;                  // strings: str_hash(), or 0 if
+                                        // not known yet
+#endif
+    };
 #endif
 } var_metadata;
 
+/* Values that are never freed (see `str_char()') start out with this
+ * count, which nothing could ever bring down to zero.
+ */
+#define REFCOUNT_IMMORTAL 0x40000000u
+
+#ifdef BIASED_REFCOUNTS
+/* The top bit of the count marks a value other threads may hold.  Until
+ * then, only the thread holding it can change its count, so it is done
+ * without a locked instruction.  See `share_var()' in utils.cc.  The
+ * counts of shared immortal values aren't kept at all.
+ */
+#define REFCOUNT_SHARED 0x80000000u
+
+static inline uint32_t
+addref(const void *ptr)
+{
+    var_metadata *metadata = ((var_metadata*)ptr) - 1;
+    uint32_t count = metadata->refcount.load(std::memory_order_relaxed);
+
+    if (count & REFCOUNT_SHARED) {
+        if (count & REFCOUNT_IMMORTAL)
+            return count & ~REFCOUNT_SHARED;
+        return ++(metadata->refcount) & ~REFCOUNT_SHARED;
+    }
+    metadata->refcount.store(++count, std::memory_order_relaxed);
+    return count;
+}
+
+static inline uint32_t
+delref(const void *ptr)
+{
+    var_metadata *metadata = ((var_metadata*)ptr) - 1;
+    uint32_t count = metadata->refcount.load(std::memory_order_relaxed);
+
+    if (count & REFCOUNT_SHARED) {
+        if (count & REFCOUNT_IMMORTAL)
+            return count & ~REFCOUNT_SHARED;
+        return --(metadata->refcount) & ~REFCOUNT_SHARED;
+    }
+    metadata->refcount.store(--count, std::memory_order_relaxed);
+    return count;
+}
+
+static inline uint32_t
+refcount(const void *ptr)
+{
+    var_metadata *metadata = ((var_metadata*)ptr) - 1;
+    return metadata->refcount.load(std::memory_order_relaxed) & ~REFCOUNT_SHARED;
+}
+
+static inline void
+share_ref(const void *ptr)
+{
+    var_metadata *metadata = ((var_metadata*)ptr) - 1;
+    metadata->refcount.fetch_or(REFCOUNT_SHARED);
+}
+#else
 static inline uint32_t
 addref(const void *ptr)
 {
@@ -71,6 +140,9 @@ refcount(const void *ptr)
     return metadata->refcount;
 }
 
+#define share_ref(ptr)		((void)0)
+#endif
+
 #ifdef ENABLE_GC
 static inline void
 gc_set_buffered(const void *ptr)
@@ -118,7 +190,8 @@ typedef enum Memory_Type {
 
     M_RT_STACK, M_RT_ENV, M_BI_FUNC_DATA, M_VM,
 
-    M_REF_ENTRY, M_REF_TABLE, M_VC_ENTRY, M_VC_TABLE, M_STRING_PTRS,
+    M_REF_ENTRY, M_REF_TABLE, M_VC_ENTRY, M_VC_TABLE, M_PROP_CACHE,
+    M_VERB_CACHE, M_PROP_INDEX, M_STRING_PTRS,
     M_INTERN_POINTER, M_INTERN_ENTRY, M_INTERN_HUNK,
 
     M_TREE, M_NODE, M_TRAV,
@@ -138,11 +211,34 @@ typedef enum Memory_Type {
 
 extern char *str_dup(const char *);
 extern const char *str_ref(const char *);
+extern const char *str_char(char c);
+				/* The string holding just C, which is
+				 * preallocated and shared by everyone
+				 * using it, so it must not be changed.
+				 */
+extern const char *str_append(const char *s, int slen,
+			      const char *t, int tlen);
+				/* Appends T to S in place; S must be
+				 * referenced only once, and is consumed.
+				 */
 
 extern void myfree(void *where, Memory_Type type);
 extern void *mymalloc(unsigned size, Memory_Type type);
 extern void *myrealloc(void *where, unsigned size, Memory_Type type);
 
+extern const char *memory_type_name(Memory_Type);
+
+#ifdef SLAB_ALLOCATOR
+extern void memory_type_usage(Memory_Type, int64_t *bytes, int64_t *count);
+				/* The bytes and number of allocations of the
+				 * given type currently live.
+				 */
+extern int64_t slab_reserved_bytes(void);
+				/* All the memory taken for slabs, in use or
+				 * not.
+				 */
+#endif
+
 static inline void		/* XXX was extern, fix for non-gcc compilers */
 free_str(const char *s)
 {
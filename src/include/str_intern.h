@@ -22,4 +22,14 @@ extern void str_intern_close(void);
    possibly share storage. */
 extern const char *str_intern(const char *s);
 
+/* As str_intern, but consumes s, which must have come from str_dup. */
+extern const char *str_intern_owned(const char *s);
+
+/* Also consumes s, a string value, and hands back the one copy of it
+   kept for as long as anything uses it, so that names (of properties,
+   and literals that might be used as them) which are equal are usually
+   the same string.  Only the main thread shares names; elsewhere s is
+   handed back as it is. */
+extern const char *str_intern_name(const char *s);
+
 #endif
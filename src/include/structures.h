@@ -260,7 +260,10 @@ str_dup_to_var(const char *s)
     Var r;
 
     r.type = TYPE_STR;
-    r.v.str = str_dup(s);
+    if (s && s[0] && !s[1])
+        r.v.str = str_char(s[0]);
+    else
+        r.v.str = str_dup(s);
 
     return r;
 }
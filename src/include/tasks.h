@@ -110,6 +110,7 @@ extern std::mutex task_queue_mutex;
 
 extern void write_task_queue(void);
 extern int read_task_queue(void);
+extern void discard_task_queue(void);
 
 extern db_verb_handle find_verb_for_programming(Objid player,
 						const char *verbref,
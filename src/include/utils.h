@@ -35,10 +35,32 @@ extern int verbcasecmp(const char *verb, const char *word);
 
 extern unsigned str_hash(const char *);
 
+#ifdef MEMO_SIZE
+/* As str_hash(), but remembered in the header of `s', which must be a
+ * string value rather than a C string.
+ */
+static inline unsigned
+memo_str_hash(const char *s)
+{
+    var_metadata *metadata = ((var_metadata *)s) - 1;
+
+    if (!metadata->hash)
+        metadata->hash = str_hash(s);
+    return metadata->hash;
+}
+#else
+#define memo_str_hash(X)	str_hash(X)
+#endif
+
 extern void complex_free_var(Var);
 extern Var complex_var_ref(Var);
 extern Var complex_var_dup(Var);
 extern int var_refcount(Var);
+extern void share_var(Var);
+				/* Marks `v', and everything in it, as
+				 * about to be seen by other threads (see
+				 * BIASED_REFCOUNTS in options.h).
+				 */
 
 extern void aux_free(Var);
 
@@ -84,6 +84,9 @@ typedef enum {
                  */
     DBV_Bool,       /* Boolean type
                      */
+    DBV_Bytecode,   /* Verb programs may be followed by their compiled
+                     * form, tagged with a compiler fingerprint.
+                     */
     Num_DB_Versions		/* Special: the current version is this - 1. */
 } DB_Version;
 
@@ -46,6 +46,48 @@
 #include "background.h"   // Threads
 #include "random.h"
 
+static inline var_metadata *
+list_metadata(Var *list)
+{
+    return ((var_metadata *)list) - 1;
+}
+
+/* Lists that are only referenced once may be grown in place.  Their
+ * storage carries spare capacity, grown geometrically, so that
+ * repeated appends (`result = {@result, x}') are amortized O(1).
+ */
+static inline bool
+list_growable(Var list)
+{
+#ifdef ENABLE_GC
+    /* the buffer of possible roots holds a pointer to it */
+    if (gc_is_buffered(list.v.list))
+        return false;
+#endif
+    return var_refcount(list) == 1;
+}
+
+/* Makes room for at least `need' elements; may move `list'. */
+static Var *
+list_reserve(Var *list, int need)
+{
+    uint32_t capacity = list_metadata(list)->capacity;
+
+    if ((uint32_t)need <= capacity)
+        return list;
+
+    capacity += capacity >> 1;
+    if (capacity < (uint32_t)need)
+        capacity = need;
+    if (capacity < 4)
+        capacity = 4;
+
+    list = (Var *)myrealloc(list, (capacity + 1) * sizeof(Var), M_LIST);
+    list_metadata(list)->capacity = capacity;
+
+    return list;
+}
+
 Var
 new_list(int size)
 {
@@ -59,10 +101,13 @@ new_list(int size)
             if ((ptr = (Var *)mymalloc(1 * sizeof(Var), M_LIST)) == nullptr)
                 panic_moo("EMPTY_LIST: mymalloc failed");
 
+            list_metadata(ptr)->capacity = 0;
+
             emptylist.type = TYPE_LIST;
             emptylist.v.list = ptr;
             emptylist.v.list[0].type = TYPE_INT;
             emptylist.v.list[0].v.num = 0;
+            share_ref(emptylist.v.list);	/* every thread uses it */
         }
 
 #ifdef ENABLE_GC
@@ -77,6 +122,8 @@ new_list(int size)
     if ((ptr = (Var *)mymalloc((size + 1) * sizeof(Var), M_LIST)) == nullptr)
         panic_moo("EMPTY_LIST: mymalloc failed");
 
+    list_metadata(ptr)->capacity = size;
+
     list.type = TYPE_LIST;
     list.v.list = ptr;
     list.v.list[0].type = TYPE_INT;
@@ -125,6 +172,23 @@ list_dup(Var list)
     return _new;
 }
 
+/* Gives back any spare capacity in a list that is about to be stored
+ * for the long term.  Consumes `list'.
+ */
+Var
+list_compact(Var list)
+{
+    int n = list.v.list[0].v.num;
+
+    if (n > 0 && list_metadata(list.v.list)->capacity > (uint32_t)n
+            && list_growable(list)) {
+        list.v.list = (Var *)myrealloc(list.v.list, (n + 1) * sizeof(Var), M_LIST);
+        list_metadata(list.v.list)->capacity = n;
+    }
+
+    return list;
+}
+
 int
 listforeach(Var list, listfunc func, void *data)
 {   /* does NOT consume `list' */
@@ -196,12 +260,13 @@ doinsert(Var list, Var value, int pos)
     int i;
     int size = list.v.list[0].v.num + 1;
 
-    if (var_refcount(list) == 1 && pos == size) {
-        list.v.list = (Var *) myrealloc(list.v.list, (size + 1) * sizeof(Var), M_LIST);
+    if (pos == size && list_growable(list)) {
+        list.v.list = list_reserve(list.v.list, size);
 #ifdef MEMO_SIZE
-        /* reset the memoized size */
-        var_metadata *metadata = ((var_metadata*)list.v.list) - 1;
-        metadata->size = 0;
+        /* keep the memoized size, if any, up to date */
+        var_metadata *metadata = list_metadata(list.v.list);
+        if (metadata->size)
+            metadata->size += value_bytes(value);
 #endif
         list.v.list[0].v.num = size;
         list.v.list[pos] = value;
@@ -276,6 +341,28 @@ listconcat(Var first, Var second)
     Var _new;
     int i;
 
+    if (lfirst > 0 && list_growable(first)) {
+        /* append to `first' in place */
+        _new = first;
+        _new.v.list = list_reserve(first.v.list, lfirst + lsecond);
+#ifdef MEMO_SIZE
+        var_metadata *metadata = list_metadata(_new.v.list);
+        if (metadata->size)
+            metadata->size += list_sizeof(second.v.list) - sizeof(Var);
+#endif
+        for (i = 1; i <= lsecond; i++)
+            _new.v.list[i + lfirst] = var_ref(second.v.list[i]);
+        _new.v.list[0].v.num = lfirst + lsecond;
+
+        free_var(second);
+
+#ifdef ENABLE_GC
+        gc_set_color(_new.v.list, GC_YELLOW);
+#endif
+
+        return _new;
+    }
+
     _new = new_list(lsecond + lfirst);
     for (i = 1; i <= lfirst; i++)
         _new.v.list[i] = var_ref(first.v.list[i]);
@@ -580,6 +667,8 @@ substr(Var str, int lower, int upper)
     r.type = TYPE_STR;
     if (lower > upper)
         r.v.str = str_dup("");
+    else if (lower == upper)
+        r.v.str = str_char(str.v.str[lower - 1]);
     else {
         int loop, index = 0;
         char *s = (char *)mymalloc(upper - lower + 2, M_STRING);
@@ -597,12 +686,9 @@ Var
 strget(Var str, int i)
 {
     Var r;
-    char *s;
 
     r.type = TYPE_STR;
-    s = str_dup(" ");
-    s[0] = str.v.str[i - 1];
-    r.v.str = s;
+    r.v.str = str_char(str.v.str[i - 1]);
     return r;
 }
 
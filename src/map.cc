@@ -71,6 +71,61 @@ node_free_data(const rbnode *node)
     free_var(node->value);
 }
 
+/*
+ * Drops one link to `node', freeing it (and dropping its own links)
+ * if that was the last.  A node with a single link can only be reached
+ * through that link, so no other thread can be changing its count.
+ */
+static void
+release_node(rbnode *node)
+{
+    while (node != nullptr) {
+        if (node->refs.load(std::memory_order_acquire) != 1
+                && --node->refs != 0)
+            return;
+
+        rbnode *save = node->link[1];
+
+        release_node(node->link[0]);
+        node_free_data(node);
+        myfree(node, M_NODE);
+
+        node = save;
+    }
+}
+
+/*
+ * Makes sure the node at `*link' belongs only to the tree being
+ * changed, replacing it with a copy if any other tree shares it.  The
+ * copy shares the children of the original.  Every node a change
+ * touches must be owned first, starting from the root, which is what
+ * makes the trees persistent: a map with more than one reference is
+ * changed by copying only the nodes on the way down.  Returns the
+ * owned node.
+ */
+static rbnode *
+own(rbnode **link)
+{
+    rbnode *node = *link;
+
+    if (node == nullptr || node->refs.load(std::memory_order_acquire) == 1)
+        return node;
+
+    rbnode *copy = (rbnode *)mymalloc(sizeof * copy, M_NODE);
+
+    copy->key = var_ref(node->key);
+    copy->value = var_ref(node->value);
+    copy->red = node->red;
+    copy->refs.store(1, std::memory_order_relaxed);
+    for (int dir = 0; dir < 2; dir++)
+        if ((copy->link[dir] = node->link[dir]) != nullptr)
+            ++copy->link[dir]->refs;
+
+    release_node(node);
+
+    return *link = copy;
+}
+
 /*
  * Returns 1 for a red node, 0 for a black node.
  */
@@ -82,14 +137,15 @@ is_red(const rbnode *root)
 
 /*
  * Performs a single red black rotation in the specified direction.
- * Assumes that all nodes are valid for a rotation.
+ * Assumes that all nodes are valid for a rotation, and that `root' is
+ * owned.
  *
  * `dir' is the direction to rotate (0 = left, 1 = right).
  */
 static rbnode *
 rbsingle(rbnode *root, int dir)
 {
-    rbnode *save = root->link[!dir];
+    rbnode *save = own(&root->link[!dir]);
 
     root->link[!dir] = save->link[dir];
     save->link[dir] = root;
@@ -102,14 +158,15 @@ rbsingle(rbnode *root, int dir)
 
 /*
  * Performs a double red black rotation in the specified direction.
- * Assumes that all nodes are valid for a rotation.
+ * Assumes that all nodes are valid for a rotation, and that `root' is
+ * owned.
  *
  * `dir' is the direction to rotate (0 = left, 1 = right).
  */
 static rbnode *
 rbdouble(rbnode *root, int dir)
 {
-    root->link[!dir] = rbsingle(root->link[!dir], !dir);
+    root->link[!dir] = rbsingle(own(&root->link[!dir]), !dir);
 
     return rbsingle(root, dir);
 }
@@ -129,8 +186,17 @@ new_node(rbtree *tree, Var key, Var value)
     rn->red = 1;
     rn->key = key;
     rn->value = value;
+    rn->refs.store(1, std::memory_order_relaxed);
     rn->link[0] = rn->link[1] = nullptr;
 
+#ifdef ENABLE_GC
+    /* See `map_dup()'. */
+    if (TYPE_ANON == value.type
+            || (TYPE_LIST == value.type && gc_get_color(value.v.list) != GC_GREEN)
+            || (TYPE_MAP == value.type && gc_get_color(value.v.tree) != GC_GREEN))
+        tree->traced = 1;
+#endif
+
     return rn;
 }
 
@@ -148,6 +214,9 @@ rbnew(void)
 
     rt->root = nullptr;
     rt->size = 0;
+#ifdef ENABLE_GC
+    rt->traced = 0;
+#endif
 
     return rt;
 }
@@ -158,29 +227,9 @@ rbnew(void)
 static void
 rbdelete(rbtree *tree)
 {
-    rbnode *it = tree->root;
-    rbnode *save;
-
-    /*
-       Rotate away the left links so that
-       we can treat this like the destruction
-       of a linked list
-     */
-    while (it != nullptr) {
-        if (it->link[0] == nullptr) {
-            /* No left links, just kill the node and move on */
-            save = it->link[1];
-            node_free_data(it);
-            myfree(it, M_NODE);
-        } else {
-            /* Rotate away the left link and check again */
-            save = it->link[0];
-            it->link[0] = save->link[1];
-            save->link[1] = it;
-        }
-
-        it = save;
-    }
+    /* Nodes still shared with other trees are left to them */
+    release_node(tree->root);
+    tree->root = nullptr;
 
     /* Since this map could possibly be the root of a cycle, final
      * destruction is handled in the garbage collector if garbage
@@ -287,7 +336,8 @@ rbinsert(rbtree *tree, rbnode *node)
         /* Set up our helpers */
         t = &head;
         g = p = nullptr;
-        q = t->link[1] = tree->root;
+        t->link[1] = tree->root;
+        q = own(&t->link[1]);
 
         /* Search down the tree for a place to insert */
         for (;;) {
@@ -300,8 +350,8 @@ rbinsert(rbtree *tree, rbnode *node)
             } else if (is_red(q->link[0]) && is_red(q->link[1])) {
                 /* Simple red violation: color flip */
                 q->red = 1;
-                q->link[0]->red = 0;
-                q->link[1]->red = 0;
+                own(&q->link[0])->red = 0;
+                own(&q->link[1])->red = 0;
             }
 
             if (is_red(q) && is_red(p)) {
@@ -329,7 +379,7 @@ rbinsert(rbtree *tree, rbnode *node)
                 t = g;
 
             g = p, p = q;
-            q = q->link[dir];
+            q = own(&q->link[dir]);
         }
 
         /* Update the root (it may be different) */
@@ -375,7 +425,7 @@ rberase(rbtree *tree, rbnode *node)
 
             /* Move the helpers down */
             g = p, p = q;
-            q = q->link[dir];
+            q = own(&q->link[dir]);
             dir = node_compare(q, node, 0) < 0;
 
             /*
@@ -390,7 +440,7 @@ rberase(rbtree *tree, rbnode *node)
                 if (is_red(q->link[!dir]))
                     p = p->link[last] = rbsingle(q, dir);
                 else if (!is_red(q->link[!dir])) {
-                    rbnode *s = p->link[!last];
+                    rbnode *s = own(&p->link[!last]);
 
                     if (s != nullptr) {
                         if (!is_red(s->link[!last])
@@ -409,8 +459,8 @@ rberase(rbtree *tree, rbnode *node)
 
                             /* Ensure correct coloring */
                             q->red = g->link[dir2]->red = 1;
-                            g->link[dir2]->link[0]->red = 0;
-                            g->link[dir2]->link[1]->red = 0;
+                            own(&g->link[dir2]->link[0])->red = 0;
+                            own(&g->link[dir2]->link[1])->red = 0;
                         }
                     }
                 }
@@ -578,8 +628,10 @@ new_map(void)
 {
     static Var map;
 
-    if (map.v.tree == nullptr)
+    if (map.v.tree == nullptr) {
         map = empty_map();
+        share_ref(map.v.tree);	/* every thread uses it */
+    }
 
 #ifdef ENABLE_GC
     assert(gc_get_color(map.v.tree) == GC_GREEN);
@@ -606,6 +658,28 @@ map_dup(Var map)
     const rbnode *pnode;
     Var _new = empty_map();
 
+#ifdef ENABLE_GC
+    /* The cycle collector visits the values of every map it reaches,
+     * and counts each visit as a reference held by that map.  A node
+     * shared by two maps holds only one, so maps whose values it
+     * might visit are still copied in full.
+     */
+    if (!map.v.tree->traced)
+#endif
+    {
+        rbnode *root = map.v.tree->root;
+
+        if (root != nullptr)
+            ++root->refs;
+        _new.v.tree->root = root;
+        _new.v.tree->size = map.v.tree->size;
+#ifdef ENABLE_GC
+        gc_set_color(_new.v.tree, gc_get_color(map.v.tree));
+#endif
+
+        return _new;
+    }
+
     for (pnode = rbtfirst(&trav, map.v.tree); pnode; pnode = rbtnext(&trav)) {
         node.key = var_ref(pnode->key);
         node.value = var_ref(pnode->value);
@@ -690,6 +764,28 @@ mapinsert(Var map, Var key, Var value)
     return _new;
 }
 
+const rbnode *
+maplookup_owned(Var map, Var key, Var *value)
+{   /* does NOT consume `map' or `key',
+       does NOT increment the ref count on `value' */
+    rbnode node;
+    rbnode **link = &map.v.tree->root;
+    rbnode *it;
+
+    node.key = key;
+    while ((it = own(link)) != nullptr) {
+        int cmp = node_compare(it, &node, 0);
+
+        if (cmp == 0)
+            break;
+        link = &it->link[cmp < 0];
+    }
+    if (it && value)
+        *value = it->value;
+
+    return it;
+}
+
 const rbnode *
 mapstrlookup(Var map, const char *key, Var *value, int case_matters)
 {
@@ -743,7 +839,7 @@ mapequal(Var lhs, Var rhs, int case_matters)
     rbtrav trav_lhs, trav_rhs;
     const rbnode *pnode_lhs = nullptr, *pnode_rhs = nullptr;
 
-    if (lhs.v.tree == rhs.v.tree)
+    if (lhs.v.tree == rhs.v.tree || lhs.v.tree->root == rhs.v.tree->root)
         return 1;
 
     while (1) {
@@ -115,10 +115,8 @@ parse_into_wordlist(const char *command)
 
     argv = parse_into_words(s, &argc);
     args = new_list(argc);
-    for (i = 1; i <= argc; i++) {
-        args.v.list[i].type = TYPE_STR;
-        args.v.list[i].v.str = str_dup(argv[i - 1]);
-    }
+    for (i = 1; i <= argc; i++)
+        args.v.list[i] = str_dup_to_var(argv[i - 1]);
     free_str(s);
     return args;
 }
@@ -186,10 +184,8 @@ finish_specials:
     pc.argstr = str_dup(argstr);
 
     pc.args = new_list(argc - 1);
-    for (i = 1; i < argc; i++) {
-        pc.args.v.list[i].type = TYPE_STR;
-        pc.args.v.list[i].v.str = str_dup(argv[i]);
-    }
+    for (i = 1; i < argc; i++)
+        pc.args.v.list[i] = str_dup_to_var(argv[i]);
 
     /*
      * look for a preposition
@@ -16,6 +16,7 @@
  *****************************************************************************/
 
 #include "ast.h"
+#include "db.h"
 #include "list.h"
 #include "parser.h"
 #include "program.h"
@@ -34,6 +35,10 @@ new_program(void)
     p->cached_lineno = 1;
     p->cached_lineno_pc = 0;
     p->cached_lineno_vec = MAIN_VECTOR;
+    p->prop_cache = nullptr;
+    p->prop_cache_mask = 0;
+    p->verb_cache = nullptr;
+    p->verb_cache_mask = 0;
     return p;
 }
 
@@ -109,6 +114,89 @@ free_program(Program * p)
 
         myfree(p->main_vector.vector, M_BYTECODES);
 
+        if (p->prop_cache) {
+            for (i = 0; i <= p->prop_cache_mask; i++)
+                db_clear_prop_cache(&p->prop_cache[i]);
+            myfree(p->prop_cache, M_PROP_CACHE);
+        }
+        if (p->verb_cache) {
+            for (i = 0; i <= p->verb_cache_mask; i++)
+                db_clear_verb_cache(&p->verb_cache[i]);
+            myfree(p->verb_cache, M_VERB_CACHE);
+        }
+
         myfree(p, M_PROGRAM);
     }
 }
+
+/* Lookup cache tables are direct mapped by opcode address and sized from
+ * the amount of code in the program; if two sites collide, the entry is
+ * simply handed over to the newcomer.
+ */
+static unsigned
+lookup_cache_size(Program * p)
+{
+    unsigned i, n = 4, size = p->main_vector.size;
+
+    for (i = 0; i < p->fork_vectors_size; i++)
+        size += p->fork_vectors[i].size;
+
+    while (n < size / 8 && n < 64)
+        n <<= 1;
+
+    return n;
+}
+
+/* Returns the property cache entry for the lookup at `site' (a pointer
+ * to the opcode in one of the program's vectors).
+ */
+db_prop_cache *
+program_prop_cache(Program * p, const Byte * site)
+{
+    db_prop_cache *entry;
+
+    if (!p->prop_cache) {
+        unsigned i, n = lookup_cache_size(p);
+
+        p->prop_cache = (db_prop_cache *)mymalloc(n * sizeof(db_prop_cache), M_PROP_CACHE);
+        for (i = 0; i < n; i++) {
+            p->prop_cache[i].site = nullptr;
+            p->prop_cache[i].name = nullptr;
+        }
+        p->prop_cache_mask = n - 1;
+    }
+
+    entry = &p->prop_cache[(uintptr_t)site & p->prop_cache_mask];
+    if (entry->site != site) {
+        db_clear_prop_cache(entry);
+        entry->site = site;
+    }
+
+    return entry;
+}
+
+/* Likewise, for the verb call at `site'. */
+db_verb_cache *
+program_verb_cache(Program * p, const Byte * site)
+{
+    db_verb_cache *entry;
+
+    if (!p->verb_cache) {
+        unsigned i, n = lookup_cache_size(p);
+
+        p->verb_cache = (db_verb_cache *)mymalloc(n * sizeof(db_verb_cache), M_VERB_CACHE);
+        for (i = 0; i < n; i++) {
+            p->verb_cache[i].site = nullptr;
+            p->verb_cache[i].name = nullptr;
+        }
+        p->verb_cache_mask = n - 1;
+    }
+
+    entry = &p->verb_cache[(uintptr_t)site & p->verb_cache_mask];
+    if (entry->site != site) {
+        db_clear_verb_cache(entry);
+        entry->site = site;
+    }
+
+    return entry;
+}
@@ -409,9 +409,10 @@ call_checkpoint_notifier(int successful)
 {
     Var args;
 
-    args = new_list(1);
+    args = new_list(2);
     args.v.list[1].type = TYPE_INT;
     args.v.list[1].v.num = successful;
+    args.v.list[2] = db_checkpoint_stats();
     run_server_task(-1, Var::new_obj(SYSTEM_OBJECT), "checkpoint_finished", args, "", nullptr);
 }
 
@@ -843,6 +844,10 @@ main_loop(void)
 #endif
             set_checkpoint_timer(0);
         }
+#ifdef THREADED_CHECKPOINTS
+        if (!checkpoint_finished)
+            checkpoint_finished = db_checkpoint_finished();
+#endif
 #ifndef UNFORKED_CHECKPOINTS
         if (checkpoint_finished) {
             call_checkpoint_notifier(checkpoint_finished - 1);
@@ -857,6 +862,8 @@ main_loop(void)
 
         run_ready_tasks();
 
+        db_flush(FLUSH_IF_FULL);
+
         /* If a exec'd child process exited, deal with it here */
         deal_with_child_exit();
 
@@ -1803,6 +1810,8 @@ read_active_connections(void)
     int count, i, have_listeners = 0;
     char c;
 
+    free_var(checkpointed_connections);
+
     i = dbio_scanf("%d active connections%c", &count, &c);
     if (i == EOF) {     /* older database format */
         checkpointed_connections = new_list(0);
@@ -1878,7 +1887,7 @@ set_system_object_integer_limits()
 void
 print_usage()
 {
-    fprintf(stderr, "Usage:\n  %s [-e] [-f script-file] [-c script-line] [-l log-file] [-m] [-w waif-type] [-O|-o] [-4 ipv4-address] [-6 ipv6-address] [-r certificate-path] [-k key-path] [-i files-path] [-x executables-path] %s [-t|-p port-number]\n",
+    fprintf(stderr, "Usage:\n  %s [-e] [-f script-file] [-c script-line] [-l log-file] [-m] [-w waif-type] [-D format] [-O|-o] [-4 ipv4-address] [-6 ipv6-address] [-r certificate-path] [-k key-path] [-i files-path] [-x executables-path] %s [-t|-p port-number]\n",
             this_program, db_usage_string());
     fprintf(stderr, "\nMETA OPTIONS\n");
     fprintf(stderr, "  %-20s %s\n", "-v, --version", "current version");
@@ -1889,6 +1898,7 @@ print_usage()
     fprintf(stderr, "\nDATABASE OPTIONS\n");
     fprintf(stderr, "  %-20s %s\n", "-m, --clear-move", "clear the `last_move' builtin property on all objects");
     fprintf(stderr, "  %-20s %s\n", "-w, --waif-type", "convert waifs from the specified type (check with typeof(waif) in your old MOO)");
+    fprintf(stderr, "  %-20s %s\n", "-D, --convert", "write the database in the given format (text, binary or compressed) and exit");
     fprintf(stderr, "  %-20s %s\n", "-f, --start-script", "file to load and pass to `#0:do_start_script()'");
     fprintf(stderr, "  %-20s %s\n", "-c, --start-line", "line to pass to `#0:do_start_script()'");
     fprintf(stderr, "\nDIRECTORY OPTIONS\n");
@@ -1921,6 +1931,7 @@ main(int argc, char **argv)
     const char *script_line = nullptr;
     int script_file_first = 0;
     int emergency = 0;
+    int convert = 0;
     Var desc = Var::new_int(0);
 
 #ifdef USE_TLS
@@ -1956,6 +1967,7 @@ main(int argc, char **argv)
         {"start-line",      required_argument,  nullptr,            'c'},
         {"waif-type",       required_argument,  nullptr,            'w'},
         {"clear-move",      no_argument,        nullptr,            'm'},
+        {"convert",         required_argument,  nullptr,            'D'},
         {"outbound",        no_argument,        nullptr,            'o'},
         {"no-outbound",     no_argument,        nullptr,            'O'},
         {"tls-port",        no_argument,        nullptr,            't'},
@@ -1970,7 +1982,7 @@ main(int argc, char **argv)
         {nullptr,           0,                  nullptr,              0}
     };
 
-    while ((c = getopt_long(argc, argv, "vel:f:c:w:moOt:4:6:p:r:k:i:x:h", long_options, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "vel:f:c:w:mD:oOt:4:6:p:r:k:i:x:h", long_options, &option_index)) != -1)
     {
         switch (c)
         {
@@ -2016,6 +2028,14 @@ main(int argc, char **argv)
                 clear_last_move = true;
                 break;
 
+            case 'D':                   /* --convert; write the database in another format and exit */
+                if (!db_set_dump_format(optarg)) {
+                    fprintf(stderr, "Unknown database format: %s\n", optarg);
+                    exit(1);
+                }
+                convert = 1;
+                break;
+
             case 'o':                   /* --outbound; enable outbound network connections */
             {
 #ifndef OUTBOUND_NETWORK
@@ -2230,6 +2250,13 @@ main(int argc, char **argv)
 
     register_bi_functions();
 
+    if (convert) {
+        if (!db_load())
+            exit(1);
+        db_shutdown();
+        exit(0);
+    }
+
     std::vector<slistener*> initial_listeners;
 
 
@@ -2388,14 +2415,52 @@ bf_reset_max_object(Var arglist, Byte next, void *vdata, Objid progr)
     return no_var_pack();
 }
 
-/* Returns total memory usage, resident set size, shared pages, text/code, and data + stack. */
+#ifdef SLAB_ALLOCATOR
+/* Maps the name of each type of allocation to its live bytes and count,
+ * with the memory taken for slabs under "SLABS".
+ */
+static Var
+memory_usage_by_type(void)
+{
+    Var r = new_map();
+    int64_t bytes, count;
+    int i;
+
+    for (i = 0; i < Sizeof_Memory_Type; i++) {
+        memory_type_usage((Memory_Type) i, &bytes, &count);
+        if (!count)
+            continue;
+
+        Var v = new_list(2);
+        v.v.list[1] = Var::new_int(bytes);
+        v.v.list[2] = Var::new_int(count);
+        r = mapinsert(r, str_dup_to_var(memory_type_name((Memory_Type) i)), v);
+    }
+    r = mapinsert(r, str_dup_to_var("SLABS"), Var::new_int(slab_reserved_bytes()));
+
+    return r;
+}
+#endif /* SLAB_ALLOCATOR */
+
+/* Returns total memory usage, resident set size, shared pages, text/code, and data + stack.
+ * With a true argument, returns what memory_usage_by_type() does instead. */
 static package
 bf_memory_usage(Var arglist, Byte next, void *vdata, Objid progr)
 {
     // LINUX: Values are returned in pages. To get KB, multiply by 4.
     // macOS: The only value available is the resident set size, which is returned in bytes.
+    bool by_type = arglist.v.list[0].v.num > 0 && is_true(arglist.v.list[1]);
+
     free_var(arglist);
 
+    if (by_type) {
+#ifdef SLAB_ALLOCATOR
+        return make_var_pack(memory_usage_by_type());
+#else
+        return make_raise_pack(E_INVARG, "Memory is only accounted for by type with SLAB_ALLOCATOR", zero);
+#endif
+    }
+
     long double size = 0.0, resident = 0.0, share = 0.0, text = 0.0, lib = 0.0, data = 0.0, dt = 0.0;
 
 #ifdef __MACH__
@@ -2620,6 +2685,13 @@ bf_db_disk_size(Var arglist, Byte next, void *vdata, Objid progr)
         return make_var_pack(v);
 }
 
+static package
+bf_checkpoint_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+    return make_var_pack(db_checkpoint_stats());
+}
+
 #ifdef OUTBOUND_NETWORK
 static slistener *
 find_slistener_by_oid(Objid obj)
@@ -3641,7 +3713,7 @@ register_server(void)
     register_function("server_version", 0, 1, bf_server_version, TYPE_ANY);
     register_function("renumber", 1, 1, bf_renumber, TYPE_OBJ);
     register_function("reset_max_object", 0, 0, bf_reset_max_object);
-    register_function("memory_usage", 0, 0, bf_memory_usage);
+    register_function("memory_usage", 0, 1, bf_memory_usage, TYPE_ANY);
 #ifdef JEMALLOC_FOUND
     register_function("malloc_stats", 0, 0, bf_malloc_stats);
 #endif
@@ -3650,6 +3722,7 @@ register_server(void)
     register_function("shutdown", 0, 1, bf_shutdown, TYPE_STR);
     register_function("dump_database", 0, 0, bf_dump_database);
     register_function("db_disk_size", 0, 0, bf_db_disk_size);
+    register_function("checkpoint_stats", 0, 0, bf_checkpoint_stats);
     register_function("open_network_connection", 2, 3, bf_open_network_connection,
                       TYPE_STR, TYPE_INT, TYPE_MAP);
     register_function("connected_players", 0, 1, bf_connected_players,
@@ -17,6 +17,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <mutex>
 
 #include "config.h"
 #include "list.h"
@@ -26,6 +28,274 @@
 #include "structures.h"
 #include "utils.h"
 
+#ifdef SLAB_ALLOCATOR
+
+/*********** Slabs ***********/
+
+/* Every block starts with a header naming its type and size class.
+ * Blocks of up to SLAB_MAX bytes (header included) of the types below
+ * come from slabs, rounded up to a multiple of SLAB_GRAIN; each thread
+ * keeps a free list per size class, trading batches of blocks with a
+ * shared pool when it runs out or has too many.  Everything else goes
+ * to malloc().
+ */
+
+typedef struct block_header {
+    uint32_t size;              /* as asked for, refcount overhead included */
+    uint16_t type;
+    uint16_t size_class;        /* or MALLOCED */
+} block_header;
+
+#define SLAB_GRAIN      16
+#define SLAB_MAX        512
+#define SLAB_CLASSES    (SLAB_MAX / SLAB_GRAIN)
+#define SLAB_BYTES      (64 * 1024)
+#define SLAB_BATCH      64
+#define MALLOCED        0xffff
+
+static inline bool
+slab_type(Memory_Type type)
+{
+    switch (type) {
+        case M_STRING:
+        case M_LIST:
+        case M_TREE:
+        case M_NODE:
+        case M_TRAV:
+        case M_RT_ENV:
+        case M_TASK:
+        case M_NETWORK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+typedef struct free_block {
+    struct free_block *next;
+} free_block;
+
+/* The free lists of one thread; whatever is on them when the thread
+ * exits goes back to the pool.
+ */
+struct slab_cache {
+    free_block *blocks[SLAB_CLASSES];
+    unsigned count[SLAB_CLASSES];
+
+    ~slab_cache();
+};
+
+static struct {
+    std::mutex lock;
+    free_block *blocks;
+    unsigned count;
+} slab_pool[SLAB_CLASSES];
+
+static thread_local slab_cache cache;
+
+static std::atomic<int64_t> live_bytes[Sizeof_Memory_Type];
+static std::atomic<int64_t> live_count[Sizeof_Memory_Type];
+static std::atomic<int64_t> slab_bytes;
+
+static inline unsigned
+size_class(size_t total)
+{
+    return (total + SLAB_GRAIN - 1) / SLAB_GRAIN - 1;
+}
+
+/* Moves up to `n' blocks from the front of `*from' to the front of `*to'. */
+static unsigned
+move_blocks(free_block **from, free_block **to, unsigned n)
+{
+    unsigned moved = 0;
+
+    while (*from && moved < n) {
+        free_block *b = *from;
+
+        *from = b->next;
+        b->next = *to;
+        *to = b;
+        moved++;
+    }
+    return moved;
+}
+
+/* Gives the calling thread more blocks of size class `c'. */
+static void
+refill(unsigned c)
+{
+    size_t block_size = (c + 1) * SLAB_GRAIN;
+    char *slab;
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> guard(slab_pool[c].lock);
+        unsigned n = move_blocks(&slab_pool[c].blocks, &cache.blocks[c], SLAB_BATCH);
+
+        slab_pool[c].count -= n;
+        cache.count[c] += n;
+        if (n)
+            return;
+    }
+
+    if (!(slab = (char *) malloc(SLAB_BYTES)))
+        return;
+    slab_bytes += SLAB_BYTES;
+    for (i = 0; i + block_size <= SLAB_BYTES; i += block_size) {
+        free_block *b = (free_block *)(slab + i);
+
+        b->next = cache.blocks[c];
+        cache.blocks[c] = b;
+        cache.count[c]++;
+    }
+}
+
+static void
+drain(unsigned c, unsigned n)
+{
+    std::lock_guard<std::mutex> guard(slab_pool[c].lock);
+
+    n = move_blocks(&cache.blocks[c], &slab_pool[c].blocks, n);
+    cache.count[c] -= n;
+    slab_pool[c].count += n;
+}
+
+slab_cache::~slab_cache()
+{
+    unsigned c;
+
+    for (c = 0; c < SLAB_CLASSES; c++)
+        drain(c, count[c]);
+}
+
+static void *
+raw_alloc(size_t total, Memory_Type type)
+{
+    block_header *h;
+    unsigned c = MALLOCED;
+
+    total += sizeof(block_header);
+    if (total <= SLAB_MAX && slab_type(type)) {
+        c = size_class(total);
+        if (!cache.blocks[c])
+            refill(c);
+        if (!(h = (block_header *) cache.blocks[c]))
+            return nullptr;
+        cache.blocks[c] = cache.blocks[c]->next;
+        cache.count[c]--;
+    } else if (!(h = (block_header *) malloc(total)))
+        return nullptr;
+
+    h->size = total - sizeof(block_header);
+    h->type = type;
+    h->size_class = c;
+    live_bytes[type].fetch_add(h->size, std::memory_order_relaxed);
+    live_count[type].fetch_add(1, std::memory_order_relaxed);
+
+    return h + 1;
+}
+
+static void
+raw_free(void *ptr)
+{
+    block_header *h = ((block_header *) ptr) - 1;
+    unsigned c = h->size_class;
+
+    live_bytes[h->type].fetch_sub(h->size, std::memory_order_relaxed);
+    live_count[h->type].fetch_sub(1, std::memory_order_relaxed);
+
+    if (c == MALLOCED) {
+        free(h);
+        return;
+    }
+    ((free_block *) h)->next = cache.blocks[c];
+    cache.blocks[c] = (free_block *) h;
+    if (++cache.count[c] > 2 * SLAB_BATCH)
+        drain(c, SLAB_BATCH);
+}
+
+static void *
+raw_realloc(void *ptr, size_t total)
+{
+    block_header *h = ((block_header *) ptr) - 1;
+    Memory_Type type = (Memory_Type) h->type;
+    bool to_slab = total + sizeof(block_header) <= SLAB_MAX && slab_type(type);
+    void *r;
+
+    if (h->size_class == MALLOCED && !to_slab) {
+        if (!(h = (block_header *) realloc(h, total + sizeof(block_header))))
+            return nullptr;
+    } else if (h->size_class == MALLOCED || !to_slab
+               || size_class(total + sizeof(block_header)) != h->size_class) {
+        if (!(r = raw_alloc(total, type)))
+            return nullptr;
+        memcpy(r, ptr, h->size < total ? h->size : total);
+        raw_free(ptr);
+        return r;
+    }
+
+    live_bytes[type].fetch_add((int64_t) total - h->size, std::memory_order_relaxed);
+    h->size = total;
+
+    return h + 1;
+}
+
+void
+memory_type_usage(Memory_Type type, int64_t *bytes, int64_t *count)
+{
+    *bytes = live_bytes[type].load(std::memory_order_relaxed);
+    *count = live_count[type].load(std::memory_order_relaxed);
+}
+
+int64_t
+slab_reserved_bytes(void)
+{
+    return slab_bytes.load(std::memory_order_relaxed);
+}
+
+#else /* !SLAB_ALLOCATOR */
+
+#define raw_alloc(total, type)  malloc(total)
+#define raw_free(ptr)           free(ptr)
+#define raw_realloc(ptr, total) realloc(ptr, total)
+
+#endif /* SLAB_ALLOCATOR */
+
+/* Indexed by `Memory_Type' */
+static const char *memory_type_names[] = {
+    "AST_POOL", "AST", "PROGRAM", "PVAL", "NETWORK", "STRING", "VERBDEF",
+    "LIST", "PREP", "PROPDEF", "OBJECT_TABLE", "OBJECT", "FLOAT", "INT",
+    "STREAM", "NAMES", "ENV", "TASK", "PATTERN", "INPUTTOKEN",
+
+    "BYTECODES", "FORK_VECTORS", "LIT_LIST",
+    "PROTOTYPE", "CODE_GEN", "DISASSEMBLE", "DECOMPILE",
+
+    "RT_STACK", "RT_ENV", "BI_FUNC_DATA", "VM",
+
+    "REF_ENTRY", "REF_TABLE", "VC_ENTRY", "VC_TABLE", "PROP_CACHE",
+    "VERB_CACHE", "PROP_INDEX", "STRING_PTRS",
+    "INTERN_POINTER", "INTERN_ENTRY", "INTERN_HUNK",
+
+    "TREE", "NODE", "TRAV",
+
+    "ANON",
+
+    "WAIF", "WAIF_XTRA",
+
+    "STRUCT", "ARRAY",
+
+    "XML_DATA"
+};
+
+static_assert(sizeof(memory_type_names) / sizeof(*memory_type_names) == Sizeof_Memory_Type,
+              "memory_type_names is out of step with Memory_Type");
+
+const char *
+memory_type_name(Memory_Type type)
+{
+    return memory_type_names[type];
+}
+
 static inline int
 refcount_overhead(Memory_Type type)
 {
@@ -62,7 +332,7 @@ mymalloc(unsigned size, Memory_Type type)
         size = 1;
 
     offs = refcount_overhead(type);
-    memptr = (char *) malloc(offs + size);
+    memptr = (char *) raw_alloc(offs + size, type);
     if (!memptr) {
         sprintf(msg, "memory allocation (size %u) failed!", size);
         panic_moo(msg);
@@ -72,7 +342,7 @@ mymalloc(unsigned size, Memory_Type type)
         memptr += offs;
         var_metadata *metadata = (var_metadata *)(memptr - sizeof(var_metadata));
 
-        metadata->refcount = 1;
+        metadata->refcount.store(1, std::memory_order_relaxed);
 
 #ifdef ENABLE_GC
         if (type == M_LIST || type == M_TREE || type == M_ANON) {
@@ -81,9 +351,14 @@ mymalloc(unsigned size, Memory_Type type)
         }
 #endif /* ENABLE_GC */
 
-#ifdef MEMO_SIZE
         if (type == M_STRING)
+            metadata->capacity = size;
+
+#ifdef MEMO_SIZE
+        if (type == M_STRING) {
             metadata->size = size - 1;
+            metadata->hash = 0;
+        }
 #endif /* MEMO_SIZE */
 
 #ifdef MEMO_SIZE
@@ -113,6 +388,7 @@ str_dup(const char *s)
         if (!emptystring) {
             emptystring = (char *) mymalloc(1, M_STRING);
             *emptystring = '\0';
+            share_ref(emptystring);	/* every thread uses it */
         }
         addref(emptystring);
         return emptystring;
@@ -123,13 +399,45 @@ str_dup(const char *s)
     return r;
 }
 
+/* Strings of one character are common (`strget()', `explode()', command
+ * words), so each is allocated once rather than for every value holding
+ * it.
+ */
+static const char **
+make_one_char_strings(void)
+{
+    static const char *table[256];
+    int c;
+
+    for (c = 1; c < 256; c++) {
+        char *s = (char *) mymalloc(2, M_STRING);
+
+        s[0] = c;
+        s[1] = '\0';
+        ((var_metadata *)s)[-1].refcount = REFCOUNT_IMMORTAL;
+        share_ref(s);		/* every thread uses them */
+        table[c] = s;
+    }
+    return table;
+}
+
+const char *
+str_char(char c)
+{
+    static const char **one_char_strings = make_one_char_strings();
+
+    if (c == '\0')
+        return str_dup("");
+    return str_ref(one_char_strings[(unsigned char) c]);
+}
+
 void *
 myrealloc(void *ptr, unsigned size, Memory_Type type)
 {
     int offs = refcount_overhead(type);
     static char msg[100];
 
-    ptr = realloc((char *) ptr - offs, size + offs);
+    ptr = raw_realloc((char *) ptr - offs, size + offs);
     if (!ptr) {
         sprintf(msg, "memory re-allocation (size %u) failed!", size);
         panic_moo(msg);
@@ -138,8 +446,38 @@ myrealloc(void *ptr, unsigned size, Memory_Type type)
     return (char *) ptr + offs;
 }
 
+/* Strings built up by repeated concatenation (`s = s + "..."') grow
+ * in place, keeping spare capacity so that each append is amortized
+ * O(1) rather than a copy of everything so far.
+ */
+const char *
+str_append(const char *s, int slen, const char *t, int tlen)
+{
+    var_metadata *metadata = ((var_metadata *)s) - 1;
+    unsigned need = slen + tlen + 1;
+    char *r = (char *)s;
+
+    if (metadata->capacity < need) {
+        unsigned capacity = metadata->capacity + (metadata->capacity >> 1);
+
+        if (capacity < need)
+            capacity = need;
+        r = (char *)myrealloc(r, capacity, M_STRING);
+        metadata = ((var_metadata *)r) - 1;
+        metadata->capacity = capacity;
+    }
+
+    memcpy(r + slen, t, tlen + 1);
+#ifdef MEMO_SIZE
+    metadata->size = slen + tlen;
+    metadata->hash = 0;
+#endif
+
+    return r;
+}
+
 void
 myfree(void *ptr, Memory_Type type)
 {
-    free((char *) ptr - refcount_overhead(type));
+    raw_free((char *) ptr - refcount_overhead(type));
 }
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <unordered_set>
 
 #include "log.h"
 #include "storage.h"
@@ -94,6 +96,11 @@ static struct intern_entry **intern_table;
 static int intern_table_size = 0;
 static int intern_table_count = 0;
 
+/* Only the thread that opened the table uses it; strings are copied on
+ * any other, so that no string is referenced by two threads.
+ */
+static std::thread::id intern_owner;
+
 static int intern_bytes_saved = 0;
 static int intern_allocations_saved = 0;
 
@@ -121,6 +128,7 @@ str_intern_open(int table_size)
     }
     intern_table = make_intern_table(table_size);
     intern_table_size = table_size;
+    intern_owner = std::this_thread::get_id();
 
     intern_bytes_saved = 0;
     intern_allocations_saved = 0;
@@ -234,7 +242,10 @@ str_intern(const char *s)
         return str_dup(s);
     }
 
-    if (intern_table == nullptr) {
+    if (s[1] == '\0')
+        return str_char(s[0]);
+
+    if (intern_table == nullptr || std::this_thread::get_id() != intern_owner) {
         return str_dup(s);
     }
 
@@ -259,6 +270,105 @@ str_intern(const char *s)
     return r;
 }
 
+/* As str_intern, but takes over the caller's reference to s, a string
+   from str_dup, and hands back either s itself or the interned copy. */
+const char *
+str_intern_owned(const char *s)
+{
+    struct intern_entry *e;
+    unsigned hash;
+
+    if (*s == '\0' || intern_table == nullptr)
+        return s;
+
+    if (s[1] == '\0') {
+        const char *r = str_char(s[0]);
+
+        free_str(s);
+        return r;
+    }
+
+    hash = memo_str_hash(s);
+
+    e = find_interned_string(s, hash);
+
+    if (e != nullptr) {
+        intern_allocations_saved++;
+        intern_bytes_saved += memo_strlen(e->s);
+        free_str(s);
+        return str_ref(e->s);
+    }
+
+    if (intern_table_count > intern_table_size) {
+        intern_rehash(intern_table_size * 2);
+    }
+
+    add_interned_string(str_ref(s), hash);
+
+    return s;
+}
+
+/**********************/
+
+/* The table of names lives as long as the server, holding one reference
+ * to each of its strings.  Those nothing else refers to any more are
+ * swept out whenever it has doubled in size since the last sweep.
+ */
+
+struct name_hash {
+    size_t operator()(const char *s) const {
+        return memo_str_hash(s);
+    }
+};
+
+struct name_equal {
+    bool operator()(const char *a, const char *b) const {
+        return a == b || !strcmp(a, b);
+    }
+};
+
+static std::unordered_set<const char *, name_hash, name_equal> names;
+static size_t names_sweep_at = 1024;
+static const std::thread::id names_owner = std::this_thread::get_id();
+
+static void
+sweep_names(void)
+{
+    for (auto it = names.begin(); it != names.end(); )
+        if (refcount(*it) == 1) {
+            const char *s = *it;
+
+            it = names.erase(it);
+            free_str(s);
+        } else
+            ++it;
+
+    names_sweep_at = names.size() * 2 > 1024 ? names.size() * 2 : 1024;
+}
+
+const char *
+str_intern_name(const char *s)
+{
+    if (!*s || std::this_thread::get_id() != names_owner)
+        return s;
+
+    auto found = names.find(s);
+
+    if (found != names.end()) {
+        const char *r = str_ref(*found);
+
+        free_str(s);
+        return r;
+    }
+
+    if (names.size() >= names_sweep_at)
+        sweep_names();
+
+    names.insert(str_ref(s));
+
+    return s;
+}
+
 #else /* STRING_INTERNING */
 
 const char *
@@ -267,6 +377,18 @@ str_intern(const char *s)
     return str_dup(s);
 }
 
+const char *
+str_intern_owned(const char *s)
+{
+    return s;
+}
+
+const char *
+str_intern_name(const char *s)
+{
+    return s;
+}
+
 void
 str_intern_close(void)
 {
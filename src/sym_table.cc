@@ -120,6 +120,10 @@ new_builtin_names(DB_Version version)
             bi->names[SLOT_TRUE] = str_dup("true");
             bi->names[SLOT_FALSE] = str_dup("false");
         }
+
+        /* copies are made by every thread compiling verbs */
+        for (unsigned i = 0; i < bi->size; i++)
+            share_ref(bi->names[i]);
     }
     return copy_names(builtins[version]);
 }
@@ -1861,6 +1861,27 @@ read_task_queue(void)
     return 1;
 }
 
+/* Throws away every task `read_task_queue()' has queued, for when a
+ * later section of the database (a checkpoint delta) supersedes them.
+ */
+void
+discard_task_queue(void)
+{
+    task *t;
+
+    while ((t = waiting_tasks)) {
+        Objid progr = (t->kind == TASK_FORKED
+                       ? t->t.forked.a.progr
+                       : progr_of_cur_verb(t->t.suspended.the_vm));
+        tqueue *tq = find_tqueue(progr, 0);
+
+        if (tq)
+            tq->num_bg_tasks--;
+        waiting_tasks = t->next;
+        free_task(t, 1);
+    }
+}
+
 /* Used in emergency mode and when handling the `.program' intrinsic
  * command.  Is only capable of finding verbs defined on permanent
  * objects (relies on `Objid' internally).
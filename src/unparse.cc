@@ -17,6 +17,7 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <mutex>
 
 #include "ast.h"
 #include "config.h"
@@ -32,7 +33,8 @@
 #include "streams.h"
 #include "utils.h"
 
-static Program *prog;
+/* per-thread, so that a checkpoint can be written by a thread of its own */
+static thread_local Program *prog;
 
 const char *
 unparse_error(enum error e)
@@ -308,7 +310,7 @@ static struct binop binop_table[] =
 
 static const char *binop_string[SizeOf_Expr_Kind];
 
-static int expr_tables_initialized = 0;
+static std::once_flag expr_tables_initialized;
 
 static void
 init_expr_tables()
@@ -320,15 +322,13 @@ init_expr_tables()
 
     for (i = 0; i < Arraysize(binop_table); i++)
         binop_string[binop_table[i].kind] = binop_table[i].string;
-
-    expr_tables_initialized = 1;
 }
 
 /********** globals *********************************/
 
-static Unparser_Receiver receiver;
-static void *receiver_data;
-static int fully_parenthesize, indent_code;
+static thread_local Unparser_Receiver receiver;
+static thread_local void *receiver_data;
+static thread_local int fully_parenthesize, indent_code;
 
 /********** AST to receiver procedures **************/
 
@@ -343,8 +343,7 @@ list_prg(Stmt * program, int p, int i)
 {
     fully_parenthesize = p;
     indent_code = i;
-    if (!expr_tables_initialized)
-        init_expr_tables();
+    std::call_once(expr_tables_initialized, init_expr_tables);
     unparse_stmt(program, 0);
 }
 
@@ -374,6 +374,50 @@ var_refcount(Var v)
     return 1;
 }
 
+#ifdef BIASED_REFCOUNTS
+static int
+share_pair(Var key, Var value, void *data, int first)
+{
+    share_var(key);
+    share_var(value);
+    return 0;
+}
+#endif
+
+/* Anonymous objects and WAIFs are shared themselves, but not what they
+ * hold, which other threads have no business reading.
+ */
+void
+share_var(Var v)
+{
+#ifdef BIASED_REFCOUNTS
+    switch (v.type) {
+        case TYPE_STR:
+            share_ref(v.v.str);
+            break;
+        case TYPE_LIST:
+            share_ref(v.v.list);
+            for (int i = 1; i <= v.v.list[0].v.num; i++)
+                share_var(v.v.list[i]);
+            break;
+        case TYPE_MAP:
+            share_ref(v.v.tree);
+            mapforeach(v, share_pair, nullptr);
+            break;
+        case TYPE_ITER:
+            share_ref(v.v.trav);
+            break;
+        case TYPE_ANON:
+            if (v.v.anon)
+                share_ref(v.v.anon);
+            break;
+        case TYPE_WAIF:
+            share_ref(v.v.waif);
+            break;
+    }
+#endif
+}
+
 int
 is_true(Var v)
 {
@@ -35,6 +35,13 @@ class TestCannedDbs < Test::Unit::TestCase
     [log.readlines.map(&:chomp), diff.readlines.map(&:chomp)]
   end
 
+  def convert(format, original, converted)
+    _, _, log, wait = Open3.popen3 %[./moo -D #{format} #{original} #{converted}]
+    status = wait.value
+
+    [status.success?, log.readlines.map(&:chomp)]
+  end
+
   public
 
   def test_that_creating_garbage_and_then_shutting_down_leaves_a_pending_anonymous_object
@@ -210,4 +217,27 @@ class TestCannedDbs < Test::Unit::TestCase
     assert log.any? { |l| l =~ /#2 not in it's content's \(#3\) location/ }
   end
 
+  def test_that_converting_to_binary_and_back_leaves_the_database_as_is
+    # Test.db is written by an older server; start from how this one writes it
+    ok, _ = convert('text', 'Test.db', '/tmp/Foo.db')
+    assert ok
+
+    %w[binary compressed].each do |format|
+      ok, _ = convert(format, '/tmp/Foo.db', '/tmp/Bar.db')
+      assert ok
+      assert_not_equal [], diff('/tmp/Foo.db', '/tmp/Bar.db')
+
+      ok, _ = convert('text', '/tmp/Bar.db', '/tmp/Baz.db')
+      assert ok
+      assert_equal [], diff('/tmp/Foo.db', '/tmp/Baz.db')
+    end
+  end
+
+  def test_that_a_verb_compiled_on_first_use_lists_and_disassembles_like_one_compiled_at_once
+    log, _ = log_and_diff('tests/Lazy.db', '/tmp/Foo.db')
+
+    assert log.any? { |l| l =~ /code matches/ }
+    assert log.any? { |l| l =~ /disassembly matches/ }
+  end
+
 end
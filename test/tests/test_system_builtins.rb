@@ -32,4 +32,25 @@ class TestSystemBuiltins < Test::Unit::TestCase
     end
   end
 
+  def test_that_checkpoint_stats_describes_the_last_checkpoint
+    run_test_as('wizard') do
+      # checkpoints are written after the requesting task has finished,
+      # and forked ones report back later still
+      stats = simplify(command(%Q|; t = time(); dump_database(); for i in [1..100]; s = checkpoint_stats(); if (length(s) && s["started"] >= t) return s; endif; suspend(0.1); endfor; return s;|))
+
+      assert_equal %w[bytes cow_pages delta elapsed format method pause phases rss started success], stats.keys.sort
+      assert_equal %w[connections finalization fsync objects programs rename tasks], stats['phases'].keys.sort
+      assert %w[unforked forked threaded].include?(stats['method'])
+      assert %w[text binary compressed].include?(stats['format'])
+      assert [0, 1].include?(stats['delta'])
+      assert [0, 1].include?(stats['success'])
+      stats['phases'].values.each { |v| assert_kind_of Float, v }
+      assert_kind_of Float, stats['elapsed']
+      assert_kind_of Float, stats['pause']
+      assert_kind_of Integer, stats['bytes']
+      assert_kind_of Integer, stats['rss']
+      assert_kind_of Integer, stats['cow_pages']
+    end
+  end
+
 end
@@ -2,6 +2,9 @@ require 'test_helper'
 
 class TestVerbCache < Test::Unit::TestCase
 
+  # verb_cache_stats() is {hits, negative hits, misses, generations,
+  # histogram, invalidated entries}
+
   def test_that_renumbering_an_object_does_not_affect_the_verb_cache
     run_test_as('wizard') do
       a = simplify(command(%Q|; a = create($nothing); return renumber(a); |))
@@ -9,21 +12,77 @@ class TestVerbCache < Test::Unit::TestCase
       add_verb(b, [player, 'xd', 'test'], ['this', 'none', 'this'])
       set_verb_code(b, 'test', ['return "test";'])
 
-      recycle(a) # should clear the cache
+      recycle(a) # forgets only what was cached for `a'
       x = verb_cache_stats()
       assert_equal E_INVIND, call(a, 'test')
       assert_equal 'test', call(b, 'test')
 
-      renumber(b) # should not clear the cache
+      renumber(b) # should not affect the cache
       y = verb_cache_stats()
       assert_equal 'test', call(a, 'test')
       assert_equal E_INVIND, call(b, 'test')
 
       z = verb_cache_stats()
 
-      subtract = lambda { |el| el[0] - el[1] }
-      assert_equal [1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0], x[4].zip(y[4]).map(&subtract)
-      assert_equal [0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0], y[4].zip(z[4]).map(&subtract)
+      assert_equal 1, y[2] - x[2]
+      assert_equal 0, z[2] - y[2]
+      assert_equal 0, z[5] - y[5]
+    end
+  end
+
+  def test_that_recycling_an_object_keeps_entries_for_other_objects
+    run_test_as('wizard') do
+      a = create(:nothing)
+      b = create(:nothing)
+      add_verb(a, [player, 'xd', 'test'], ['this', 'none', 'this'])
+      set_verb_code(a, 'test', ['return "a";'])
+      add_verb(b, [player, 'xd', 'test'], ['this', 'none', 'this'])
+      set_verb_code(b, 'test', ['return "b";'])
+
+      assert_equal 'a', call(a, 'test')
+      assert_equal 'b', call(b, 'test')
+
+      x = verb_cache_stats()
+      recycle(a)
+      y = verb_cache_stats()
+      assert_equal 'b', call(b, 'test')
+      z = verb_cache_stats()
+
+      assert_operator y[5] - x[5], :>=, 1
+      assert_equal 0, z[2] - y[2]
+    end
+  end
+
+  def test_that_changing_verbs_invalidates_cached_entries
+    run_test_as('wizard') do
+      a = create(:nothing)
+      b = create(a)
+      add_verb(a, [player, 'xd', 'test'], ['this', 'none', 'this'])
+      set_verb_code(a, 'test', ['return "a";'])
+
+      assert_equal 'a', call(a, 'test')
+      assert_equal 'a', call(b, 'test')
+
+      x = verb_cache_stats()
+      assert_equal 'a', call(a, 'test')
+      assert_equal 'a', call(b, 'test')
+      y = verb_cache_stats()
+
+      assert_equal 0, y[2] - x[2]
+      assert_equal 0, y[5] - x[5]
+
+      # restamps `a' and its descendants
+      add_verb(a, [player, 'xd', 'other'], ['this', 'none', 'this'])
+
+      y = verb_cache_stats()
+      assert_equal 'a', call(a, 'test')
+      assert_equal 'a', call(b, 'test')
+      z = verb_cache_stats()
+
+      # both lookups share the entry made for `a', the first object
+      # with verbs; it is dropped and made again once
+      assert_equal 1, z[5] - y[5]
+      assert_equal 1, z[2] - y[2]
     end
   end
 